@@ -0,0 +1,178 @@
+/* contrib/aqo/aqo--1.6--1.7.sql */
+
+-- complain if script is sourced in psql, rather than via CREATE EXTENSION
+\echo Use "ALTER EXTENSION aqo UPDATE TO '1.7'" to load this file. \quit
+
+DROP VIEW aqo_queries;
+DROP FUNCTION aqo_queries;
+
+CREATE FUNCTION aqo_queries (
+  OUT queryid                bigint,
+  OUT fs                     bigint,
+  OUT learn_aqo              boolean,
+  OUT use_aqo                boolean,
+  OUT auto_tuning            boolean,
+  OUT smart_timeout          bigint,
+  OUT count_increase_timeout bigint,
+  OUT plan_overhead          double precision,
+  OUT plan_degradation       integer,
+  OUT join_limit             integer,
+  OUT learn_rate             double precision
+)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'aqo_queries'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+
+CREATE VIEW aqo_queries AS SELECT * FROM aqo_queries();
+
+CREATE FUNCTION aqo_learning_counters(
+  OUT learned bigint,
+  OUT skipped bigint
+)
+RETURNS record
+AS 'MODULE_PATHNAME', 'aqo_learning_counters'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+COMMENT ON FUNCTION aqo_learning_counters() IS
+'Get numbers of learning samples, passed to the knowledge base and skipped because of the accurate prediction, since the last aqo_reset()';
+
+DROP VIEW aqo_query_stat;
+DROP FUNCTION aqo_query_stat;
+
+CREATE FUNCTION aqo_query_stat (
+  OUT queryid                           bigint,
+  OUT execution_time_with_aqo           double precision[],
+  OUT execution_time_without_aqo        double precision[],
+  OUT planning_time_with_aqo            double precision[],
+  OUT planning_time_without_aqo         double precision[],
+  OUT cardinality_error_with_aqo        double precision[],
+  OUT cardinality_error_without_aqo     double precision[],
+  OUT executions_with_aqo               bigint,
+  OUT executions_without_aqo            bigint,
+  OUT execution_time_mean_with_aqo      double precision,
+  OUT execution_time_stddev_with_aqo    double precision,
+  OUT execution_time_quantiles_with_aqo double precision[],
+  OUT execution_time_mean_without_aqo   double precision,
+  OUT execution_time_stddev_without_aqo double precision,
+  OUT execution_time_quantiles_without_aqo double precision[],
+  OUT cardinality_error_mean_with_aqo   double precision,
+  OUT cardinality_error_mean_without_aqo double precision
+)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'aqo_query_stat'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+
+CREATE VIEW aqo_query_stat AS SELECT * FROM aqo_query_stat();
+
+CREATE FUNCTION aqo_overhead(
+  OUT queryid    bigint,
+  OUT hook       text,
+  OUT calls      bigint,
+  OUT total_time double precision,
+  OUT mean_time  double precision
+)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'aqo_overhead'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+COMMENT ON FUNCTION aqo_overhead() IS
+'Get calls and time (ms) of each AQO hook for each query class, tracked with aqo.track_overhead';
+
+CREATE VIEW aqo_overhead AS SELECT * FROM aqo_overhead();
+
+CREATE FUNCTION aqo_overhead_reset()
+RETURNS bigint
+AS 'MODULE_PATHNAME', 'aqo_overhead_reset'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+COMMENT ON FUNCTION aqo_overhead_reset() IS
+'Reset counters of the aqo_overhead view. Returns number of query classes with non-zero counters';
+
+CREATE FUNCTION aqo_prediction_stat(
+  OUT queryid          bigint,
+  OUT exact            bigint,
+  OUT wide             bigint,
+  OUT few_neighbors    bigint,
+  OUT misses           bigint,
+  OUT hit_rate         double precision,
+  OUT wide_scans       bigint,
+  OUT wide_scan_length double precision,
+  OUT collisions       bigint
+)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'aqo_prediction_stat'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+COMMENT ON FUNCTION aqo_prediction_stat() IS
+'Get outcomes of cardinality predictions for each query class: found in the own feature space, found by the wide search, refused because of too few neighbours, missed';
+
+CREATE VIEW aqo_prediction_stat AS SELECT * FROM aqo_prediction_stat();
+
+CREATE FUNCTION aqo_prediction_counters(
+  OUT exact            bigint,
+  OUT wide             bigint,
+  OUT few_neighbors    bigint,
+  OUT misses           bigint,
+  OUT hit_rate         double precision,
+  OUT wide_scans       bigint,
+  OUT wide_scan_length double precision,
+  OUT collisions       bigint
+)
+RETURNS record
+AS 'MODULE_PATHNAME', 'aqo_prediction_counters'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+COMMENT ON FUNCTION aqo_prediction_counters() IS
+'Get total outcomes of cardinality predictions of all query classes since the last reset';
+
+CREATE FUNCTION aqo_prediction_stat_reset()
+RETURNS bigint
+AS 'MODULE_PATHNAME', 'aqo_prediction_stat_reset'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+COMMENT ON FUNCTION aqo_prediction_stat_reset() IS
+'Reset prediction counters. Returns number of query classes with non-zero counters';
+
+CREATE FUNCTION aqo_lock_stat(
+  OUT lock         text,
+  OUT acquisitions bigint,
+  OUT contended    bigint,
+  OUT wait_time    double precision
+)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'aqo_lock_stat'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+COMMENT ON FUNCTION aqo_lock_stat() IS
+'Get acquisitions of the AQO locks: total, which had to wait and the waiting time in milliseconds';
+
+CREATE FUNCTION aqo_lock_stat_reset()
+RETURNS bigint
+AS 'MODULE_PATHNAME', 'aqo_lock_stat_reset'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+COMMENT ON FUNCTION aqo_lock_stat_reset() IS
+'Reset counters of the AQO locks. Returns number of locks with non-zero counters';
+
+CREATE FUNCTION aqo_dsa_stat(
+  OUT area            text,
+  OUT allocations     bigint,
+  OUT frees           bigint,
+  OUT allocated_bytes bigint,
+  OUT freed_bytes     bigint,
+  OUT used_bytes      bigint
+)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'aqo_dsa_stat'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+COMMENT ON FUNCTION aqo_dsa_stat() IS
+'Get allocations and frees of memory in the DSA areas of the query texts and ML data since the start of the instance';
+
+CREATE FUNCTION aqo_memory_peaks(
+  OUT name      text,
+  OUT peak_size bigint
+)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'aqo_memory_peaks'
+LANGUAGE C STRICT VOLATILE PARALLEL RESTRICTED;
+COMMENT ON FUNCTION aqo_memory_peaks() IS
+'Get peak sizes of the AQO memory contexts of the backend, tracked with aqo.track_overhead';
+
+CREATE FUNCTION aqo_memory_peaks_reset()
+RETURNS bigint
+AS 'MODULE_PATHNAME', 'aqo_memory_peaks_reset'
+LANGUAGE C STRICT VOLATILE PARALLEL RESTRICTED;
+COMMENT ON FUNCTION aqo_memory_peaks_reset() IS
+'Reset peak sizes of the AQO memory contexts of the backend. Returns number of contexts with non-zero peaks';
@@ -23,6 +23,8 @@
 #include "aqo.h"
 #include "aqo_shared.h"
 #include "cardinality_hooks.h"
+#include "counters.h"
+#include "learn_queue.h"
 #include "path_utils.h"
 #include "postmaster/bgworker.h"
 #include "preprocessing.h"
@@ -50,9 +52,13 @@ int 	aqo_statement_timeout;
  *
  * aqo_show_details - show AQO settings for this class and prediction
  * for each plan node.
+ *
+ * aqo_show_provenance - show source, model rows, nearest neighbour distance
+ * and time of the prediction for each plan node.
  */
 bool	aqo_show_hash;
 bool	aqo_show_details;
+bool	aqo_show_provenance;
 bool	change_flex_timeout;
 
 /* GUC variables */
@@ -140,6 +146,7 @@ aqo_free_callback(ResourceReleasePhase phase,
 
 	if (isTopLevel)
 	{
+		aqo_memory_peak(AQO_MEMCTX_CACHE, AQOCacheMemCtx);
 		MemoryContextReset(AQOCacheMemCtx);
 		cur_classes = NIL;
 	}
@@ -189,7 +196,7 @@ aqo_drop_access_hook(ObjectAccessType access,
 		pid_t pid;
 
 		old_ctx = MemoryContextSwitchTo(AQOTopMemCtx);
-		LWLockAcquire(&aqo_state->lock, LW_EXCLUSIVE);
+		aqo_lwlock_acquire(&aqo_state->lock, LW_EXCLUSIVE);
 		if (aqo_state->bgw_handle != NULL)
 		{
 			status = GetBackgroundWorkerPid(aqo_state->bgw_handle, &pid);
@@ -239,7 +246,7 @@ aqo_bgworker_startup(void)
 				 errmsg("could not start background process"),
 				 errhint("More details may be available in the server log.")));
 
-	LWLockAcquire(&aqo_state->lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->lock, LW_EXCLUSIVE);
 	aqo_state->bgw_handle = handle;
 	LWLockRelease(&aqo_state->lock);
 }
@@ -315,6 +322,19 @@ _PG_init(void)
 							 NULL
 	);
 
+	DefineCustomBoolVariable(
+							 "aqo.show_provenance",
+							 "Show on explain, how AQO predicted the cardinality of each plan node.",
+							 "Shows the source of the prediction, rows of the model, distance to the nearest neighbour and time of the prediction. Must be enabled at the planning.",
+							 &aqo_show_provenance,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
 	DefineCustomBoolVariable(
 							 "aqo.learn_statement_timeout",
 							 "Learn on a plan interrupted by statement timeout.",
@@ -328,6 +348,32 @@ _PG_init(void)
 							 NULL
 	);
 
+	DefineCustomBoolVariable(
+							 "aqo.learn_on_abort",
+							 "Learn on a plan interrupted by an error or a cancellation.",
+							 "Partially executed plan nodes are learned with reduced reliability at the start of the next statement.",
+							 &aqo_learn_on_abort,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomBoolVariable(
+							 "aqo.track_overhead",
+							 "Track calls and time of the AQO hooks.",
+							 "Counters are shown by the aqo_overhead view.",
+							 &aqo_track_overhead,
+							 false,
+							 PGC_SUSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
 	DefineCustomBoolVariable(
 							 "aqo.wide_search",
 							 "Search ML data in neighbour feature spaces.",
@@ -354,6 +400,82 @@ _PG_init(void)
 							NULL
 	);
 
+	DefineCustomRealVariable("aqo.planning_overhead_limit",
+							 "Sets the limit of AQO share in the planning time of a query class.",
+							 "If the time, spent in AQO estimation hooks, exceeds this fraction of the planning time, AQO degrades the prediction for the query class step by step. Zero disables the limit.",
+							 &aqo_planning_overhead_limit,
+							 0.0,
+							 0.0, 1.0,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomIntVariable("aqo.min_execution_time",
+							"Sets the minimal execution time (in microseconds) of a query to learn on it.",
+							"Faster executions are only counted in the query class statistics. Zero means no limit.",
+							&aqo_min_execution_time,
+							0,
+							0, INT_MAX,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomRealVariable("aqo.fast_execution_sample_rate",
+							 "Sets the share of fast executions to learn on anyway.",
+							 "See aqo.min_execution_time.",
+							 &aqo_fast_execution_sample_rate,
+							 0.01,
+							 0.0, 1.0,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomBoolVariable("aqo.lightweight_instrumentation",
+							 "Count rows of plan nodes without the executor instrumentation.",
+							 "AQO needs numbers of tuples and loops of plan nodes only. If enabled, AQO counts them with its own wrapper of plan nodes instead of the INSTRUMENT_ROWS instrumentation, if the query isn't instrumented for another reason and doesn't use parallel workers.",
+							 &aqo_lightweight_instrumentation,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomRealVariable("aqo.learn_tolerance",
+							 "Sets the relative error of a plan node prediction, small enough to skip learning on the node.",
+							 "Zero means learning on each plan node.",
+							 &aqo_learn_tolerance,
+							 0.0,
+							 0.0, 1.0,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
+	DefineCustomRealVariable("aqo.learn_rate_min",
+							 "Sets the minimal share of executions of a converged query class to learn on.",
+							 "While the cardinality error of a query class doesn't change, AQO learns on a decaying random sample of its executions, but not less than this share. 1 means learning on each execution.",
+							 &aqo_learn_rate_min,
+							 1.0,
+							 0.001, 1.0,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL
+	);
+
 	DefineCustomIntVariable("aqo.fs_max_items",
 							"Max number of feature spaces that AQO can operate with.",
 							NULL,
@@ -451,6 +573,28 @@ _PG_init(void)
 							 NULL,
 							 NULL);
 
+	DefineCustomIntVariable("aqo.learn_workers",
+							"Number of background workers which apply learning samples to the knowledge base.",
+							"Zero means that each backend learns synchronously at the end of execution.",
+							&aqo_learn_workers,
+							0, 0, AQO_LEARN_WORKERS_MAX,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("aqo.learn_queue_size",
+							"Max number of learning samples waiting for a learning worker.",
+							NULL,
+							&aqo_learn_queue_size,
+							1024, 16, INT_MAX / 1024,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
 	prev_shmem_startup_hook						= shmem_startup_hook;
 	shmem_startup_hook							= aqo_init_shmem;
 	prev_planner_hook							= planner_hook;
@@ -524,7 +668,9 @@ _PG_init(void)
 											 "AQOLearnMemoryContext",
 											 ALLOCSET_DEFAULT_SIZES);
 	RegisterResourceReleaseCallback(aqo_free_callback, NULL);
+	RegisterXactCallback(aqo_xact_callback, NULL);
 	RegisterAQOPlanNodeMethods();
+	learn_queue_register_workers();
 
 	MarkGUCPrefixReserved("aqo");
 }
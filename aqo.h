@@ -172,9 +172,37 @@ extern int	aqo_mode;
 extern bool	force_collect_stat;
 extern bool aqo_show_hash;
 extern bool aqo_show_details;
+extern bool aqo_show_provenance;
 extern int aqo_join_threshold;
+extern double aqo_planning_overhead_limit;
+extern double aqo_learn_rate_min;
 extern bool use_wide_search;
 extern bool aqo_learn_statement_timeout;
+extern bool aqo_learn_on_abort;
+extern double aqo_learn_tolerance;
+extern bool aqo_lightweight_instrumentation;
+extern int aqo_min_execution_time;
+extern double aqo_fast_execution_sample_rate;
+
+/*
+ * Degradation of AQO prediction for a query class, which exceeds the planning
+ * overhead limit. Each next level includes all the previous ones.
+ */
+typedef enum
+{
+	/* Full-featured prediction */
+	AQO_DEGRADE_NONE = 0,
+	/* Don't predict cardinality of parameterized paths */
+	AQO_DEGRADE_PARAM_PATHS,
+	/* Don't search ML data in neighbour feature spaces */
+	AQO_DEGRADE_WIDE_SEARCH,
+	/* Don't predict joins of more than join_limit relations */
+	AQO_DEGRADE_JOIN_LIMIT,
+}	AQO_DEGRADATION;
+
+#define AQO_PLANNING_DEGRADED(level) \
+	(aqo_planning_overhead_limit > 0. && \
+	 query_context.plan_degradation >= (level))
 
 /* Parameters for current query */
 typedef struct QueryContextData
@@ -201,6 +229,20 @@ typedef struct QueryContextData
 	double		planning_time;
 	int64		smart_timeout;
 	int64		count_increase_timeout;
+
+	/* Planning overhead budget state of the query class */
+	int			plan_degradation;
+	int			join_limit;
+
+	/*
+	 * Time, spent in AQO estimation hooks, and the largest join predicted
+	 * during the planning.
+	 */
+	instr_time	predict_time;
+	int			max_join_rels;
+
+	/* Learning sampling rate of the query class */
+	double		learn_rate;
 } QueryContextData;
 
 /*
@@ -223,8 +265,6 @@ extern double auto_tuning_convergence_error;
 
 /* Machine learning parameters */
 
-extern int	aqo_k;
-extern bool aqo_predict_with_few_neighbors;
 extern double log_selectivity_lower_bound;
 
 /* Parameters for current query */
@@ -286,6 +326,12 @@ void aqo_ExecutorStart(QueryDesc *queryDesc, int eflags);
 void aqo_ExecutorRun(QueryDesc *queryDesc, ScanDirection direction,
 					 uint64 count, bool execute_once);
 void aqo_ExecutorEnd(QueryDesc *queryDesc);
+extern void aqo_xact_callback(XactEvent event, void *arg);
+extern void aqo_store_plan_features(PlannedStmt *stmt);
+extern void learn_batch_begin(void);
+extern void learn_batch_add(uint64 fs, int fss, int ncols, double *features,
+							double target, double rfactor, List *reloids);
+extern void learn_batch_apply(bool queued);
 
 /* Automatic query tuning */
 extern void automatical_query_tuning(uint64 query_hash, struct StatEntry *stat);
@@ -307,7 +353,10 @@ extern void selectivity_cache_clear(void);
 extern bool IsQueryDisabled(void);
 
 extern bool update_query_timeout(uint64 queryid, int64 smart_timeout);
-extern double get_mean(double *elems, int nelems);
+extern bool update_query_plan_overhead(uint64 queryid, double overhead,
+									   int max_join_rels);
+extern bool update_query_learn_rate(uint64 queryid, double error);
+extern double get_mean(float4 *elems, int nelems);
 
 extern List *cur_classes;
 #endif
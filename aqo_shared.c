@@ -9,6 +9,8 @@
 #include "storage/shmem.h"
 
 #include "aqo_shared.h"
+#include "counters.h"
+#include "learn_queue.h"
 #include "storage.h"
 
 
@@ -50,6 +52,8 @@ aqo_init_shmem(void)
 		aqo_state->data_changed = false;
 		aqo_state->queries_changed = false;
 		aqo_state->bgw_handle = NULL;
+		pg_atomic_init_u64(&aqo_state->learned_samples, 0);
+		pg_atomic_init_u64(&aqo_state->skipped_samples, 0);
 
 		LWLockInitialize(&aqo_state->lock, LWLockNewTrancheId());
 		LWLockInitialize(&aqo_state->stat_lock, LWLockNewTrancheId());
@@ -59,7 +63,7 @@ aqo_init_shmem(void)
 	}
 
 	info.keysize = sizeof(((StatEntry *) 0)->queryid);
-	info.entrysize = sizeof(StatEntry);
+	info.entrysize = sizeof(StatHashEntry);
 	stat_htab = ShmemInitHash("AQO Stat HTAB", fs_max_items, fs_max_items,
 							  &info, HASH_ELEM | HASH_BLOBS);
 
@@ -77,10 +81,13 @@ aqo_init_shmem(void)
 
 	/* Shared memory hash table for queries */
 	info.keysize = sizeof(((QueriesEntry *) 0)->queryid);
-	info.entrysize = sizeof(QueriesEntry);
+	info.entrysize = sizeof(QueriesHashEntry);
 	queries_htab = ShmemInitHash("AQO Queries HTAB", fs_max_items, fs_max_items,
 								 &info, HASH_ELEM | HASH_BLOBS);
 
+	learn_queue_init_shmem();
+	counters_init_shmem();
+
 	LWLockRelease(AddinShmemInitLock);
 	LWLockRegisterTranche(aqo_state->lock.tranche, "AQO");
 	LWLockRegisterTranche(aqo_state->stat_lock.tranche, "AQO Stat Lock Tranche");
@@ -124,10 +131,12 @@ aqo_memsize(void)
 
 	size = MAXALIGN(sizeof(AQOSharedState));
 	size = add_size(size, hash_estimate_size(fs_max_items, sizeof(AQOSharedState)));
-	size = add_size(size, hash_estimate_size(fs_max_items, sizeof(StatEntry)));
+	size = add_size(size, hash_estimate_size(fs_max_items, sizeof(StatHashEntry)));
 	size = add_size(size, hash_estimate_size(fs_max_items, sizeof(QueryTextEntry)));
 	size = add_size(size, hash_estimate_size(fss_max_items, sizeof(DataEntry)));
-	size = add_size(size, hash_estimate_size(fs_max_items, sizeof(QueriesEntry)));
+	size = add_size(size, hash_estimate_size(fs_max_items, sizeof(QueriesHashEntry)));
+	size = add_size(size, learn_queue_memsize());
+	size = add_size(size, counters_memsize());
 
 	return size;
 }
@@ -2,6 +2,7 @@
 #define AQO_SHARED_H
 
 #include "lib/dshash.h"
+#include "port/atomics.h"
 #include "postmaster/bgworker.h"
 #include "storage/dsm.h"
 #include "storage/ipc.h"
@@ -31,6 +32,10 @@ typedef struct AQOSharedState
 	bool		queries_changed;
 
 	BackgroundWorkerHandle	*bgw_handle;
+
+	/* Learning samples, passed to the knowledge base and skipped as accurate */
+	pg_atomic_uint64	learned_samples;
+	pg_atomic_uint64	skipped_samples;
 } AQOSharedState;
 
 
@@ -0,0 +1,54 @@
+#ifndef AQO_TRACE_H
+#define AQO_TRACE_H
+
+#include "portability/instr_time.h"
+
+/*
+ * Static probes of AQO. If the server is configured with --enable-dtrace, the
+ * Makefile generates aqo_probes.h by aqo_probes.d. Otherwise, the probes are
+ * empty macros.
+ * A probe with a time argument is paired with its *_ENABLED() macro to read
+ * the clock only while the probe is traced. The start time is zeroed before,
+ * so the probe is skipped if the tracing began in the middle of the call.
+ */
+#ifdef ENABLE_DTRACE
+
+#include "aqo_probes.h"
+
+#else
+
+#define TRACE_AQO_PREDICTION_START(INT1, INT2) do {} while (0)
+#define TRACE_AQO_PREDICTION_START_ENABLED() (0)
+#define TRACE_AQO_PREDICTION_DONE(INT1, INT2, INT3, INT4) do {} while (0)
+#define TRACE_AQO_PREDICTION_DONE_ENABLED() (0)
+#define TRACE_AQO_LEARN_START(INT1, INT2, INT3) do {} while (0)
+#define TRACE_AQO_LEARN_START_ENABLED() (0)
+#define TRACE_AQO_LEARN_DONE(INT1, INT2, INT3, INT4) do {} while (0)
+#define TRACE_AQO_LEARN_DONE_ENABLED() (0)
+#define TRACE_AQO_STORAGE_STORE_START(INT1) do {} while (0)
+#define TRACE_AQO_STORAGE_STORE_START_ENABLED() (0)
+#define TRACE_AQO_STORAGE_STORE_DONE(INT1, INT2, INT3) do {} while (0)
+#define TRACE_AQO_STORAGE_STORE_DONE_ENABLED() (0)
+#define TRACE_AQO_STORAGE_LOAD_START(INT1) do {} while (0)
+#define TRACE_AQO_STORAGE_LOAD_START_ENABLED() (0)
+#define TRACE_AQO_STORAGE_LOAD_DONE(INT1, INT2, INT3) do {} while (0)
+#define TRACE_AQO_STORAGE_LOAD_DONE_ENABLED() (0)
+#define TRACE_AQO_TUNING_DECISION(INT1, INT2, INT3, INT4) do {} while (0)
+#define TRACE_AQO_TUNING_DECISION_ENABLED() (0)
+
+#endif							/* ENABLE_DTRACE */
+
+/*
+ * Microseconds elapsed since the start.
+ */
+static inline int64
+aqo_trace_elapsed(instr_time start)
+{
+	instr_time	now;
+
+	INSTR_TIME_SET_CURRENT(now);
+	INSTR_TIME_SUBTRACT(now, start);
+	return (int64) INSTR_TIME_GET_MICROSEC(now);
+}
+
+#endif							/* AQO_TRACE_H */
@@ -19,6 +19,7 @@
 
 #include "common/pg_prng.h"
 #include "aqo.h"
+#include "aqo_trace.h"
 #include "storage.h"
 
 /*
@@ -27,16 +28,16 @@
  */
 double auto_tuning_convergence_error = 0.01;
 
-static double get_estimation(double *elems, int nelems);
-static bool is_stable(double *elems, int nelems);
-static bool converged_cq(double *elems, int nelems);
-static bool is_in_infinite_loop_cq(double *elems, int nelems);
+static double get_time_estimation(StatEWMA *exec_time, StatEWMA *plan_time);
+static bool is_stable(float4 *elems, int nelems);
+static bool converged_cq(float4 *elems, int nelems);
+static bool is_in_infinite_loop_cq(float4 *elems, int nelems);
 
 /*
- * Returns mean value of the array of doubles.
+ * Returns mean value of the series.
  */
 double
-get_mean(double *elems, int nelems)
+get_mean(float4 *elems, int nelems)
 {
 	double	sum = 0;
 	int		i;
@@ -49,29 +50,23 @@ get_mean(double *elems, int nelems)
 }
 
 /*
- * Having a time series it tries to predict its next value.
- * Now it do simple window averaging.
+ * Predict the next total time of the query by the streaming means. The ring
+ * buffers are too short for that.
  */
 static double
-get_estimation(double *elems, int nelems)
+get_time_estimation(StatEWMA *exec_time, StatEWMA *plan_time)
 {
-	int start;
+	Assert(exec_time->n > 0);
 
-	Assert(nelems > 0);
-
-	if (nelems > auto_tuning_window_size)
-		start = nelems - auto_tuning_window_size;
-	else
-		start = 0;
-
-	return get_mean(&elems[start], nelems - start);
+	/* Planning time is unknown for cached plans */
+	return exec_time->mean + (plan_time->n > 0 ? plan_time->mean : 0.);
 }
 
 /*
  * Checks whether the series is stable with absolute or relative error.
  */
 static bool
-is_stable(double *elems, int nelems)
+is_stable(float4 *elems, int nelems)
 {
 	double	est,
 			last;
@@ -92,7 +87,7 @@ is_stable(double *elems, int nelems)
  * absolute or relative error.
  */
 static bool
-converged_cq(double *elems, int nelems)
+converged_cq(float4 *elems, int nelems)
 {
 	if (nelems < auto_tuning_window_size + 2)
 		return false;
@@ -108,7 +103,7 @@ converged_cq(double *elems, int nelems)
  * absolute or relative error 0.1.
  */
 static bool
-is_in_infinite_loop_cq(double *elems, int nelems)
+is_in_infinite_loop_cq(float4 *elems, int nelems)
 {
 	if (nelems - auto_tuning_infinite_loop < auto_tuning_window_size + 2)
 		return false;
@@ -117,6 +112,64 @@ is_in_infinite_loop_cq(double *elems, int nelems)
 		   !converged_cq(elems, nelems - auto_tuning_window_size);
 }
 
+/*
+ * Standard normal variate by the Box-Muller transform.
+ */
+static double
+random_normal(void)
+{
+	double	u1 = 1. - pg_prng_double(&pg_global_prng_state); /* (0..1] */
+	double	u2 = pg_prng_double(&pg_global_prng_state);
+
+	return sqrt(-2. * log(u1)) * cos(2. * M_PI * u2);
+}
+
+/*
+ * Draw a sample of the mean total (planning + execution) time of the query
+ * for one arm of the bandit (with or without AQO).
+ *
+ * The mean is assumed to be normally distributed around its streaming
+ * estimation. The number of observations is limited by the memory of the
+ * streaming aggregates, so the arm never becomes 'certain' and the estimation
+ * follows drift of the data. Noise less than auto_tuning_exploration of the
+ * mean is not trusted, because the variance of a few executions is
+ * unreliable. At last, the variance grows while the arm isn't played, so a
+ * neglected arm is re-explored from time to time.
+ *
+ * Executions faster than aqo.min_execution_time are mostly counted without
+ * their times, so the observations are counted by the aggregates, not by the
+ * execution counters. An arm without timed executions has no estimation at
+ * all. Its prior is the estimation of the other arm with the deviation equal
+ * to the mean, so it is played about as often as the other arm until it gets
+ * its own timed executions.
+ */
+static double
+sample_time_estimation(StatEWMA *exec_time, StatEWMA *plan_time,
+					   StatEWMA *other_exec_time, StatEWMA *other_plan_time)
+{
+	double	mean;
+	double	var;
+	double	nobs;
+	int64	ntotal = exec_time->n + other_exec_time->n;
+
+	if (exec_time->n == 0)
+	{
+		/* If both arms have no timed executions, it is a coin toss */
+		mean = (other_exec_time->n > 0) ?
+				get_time_estimation(other_exec_time, other_plan_time) : 1.;
+		return mean + mean * random_normal();
+	}
+
+	mean = get_time_estimation(exec_time, plan_time);
+	var = exec_time->var + (plan_time->n > 0 ? plan_time->var : 0.);
+	var = Max(var, pow(auto_tuning_exploration * mean, 2));
+
+	nobs = Min((double) exec_time->n, 1. / STAT_EWMA_WEIGHT);
+	var = var / nobs * ((double) ntotal / exec_time->n);
+
+	return mean + sqrt(var) * random_normal();
+}
+
 /*
  * Here we use execution statistics for the given query tuning. Note that now
  * we cannot execute queries on our own wish, so the tuning now is in setting
@@ -129,81 +182,61 @@ is_in_infinite_loop_cq(double *elems, int nelems)
  * Secondly, we run the query type with both AQO usage and AQO learning enabled
  * until convergence.
  *
- * If AQO provides better execution time for the query type according to
- * collected statistics, we prefer to enable it, otherwise we prefer to disable
- * it.
- * In the stable workload case we perform an exploration. That means that with
- * some probability which depends on execution time with and without using AQO
- * we run the slower method to check whether it remains slower.
+ * After that the choice between using and not using AQO is a two-armed bandit,
+ * played by the Thompson sampling: for each arm we draw a possible mean of the
+ * total query time from its distribution (see sample_time_estimation) and use
+ * the arm with the smaller draw. So the faster option is chosen more and more
+ * often while the difference becomes clear, and the slower one is still
+ * re-explored from time to time, as its estimation ages.
  * Cardinality statistics collection is enabled by default in this mode.
  * If we find out that cardinality quality diverged during the exploration, we
  * return to step 2 and run the query type with both AQO usage and AQO learning
  * enabled until convergence.
- * If after auto_tuning_max_iterations steps we see that for this query
- * it is better not to use AQO, we set auto_tuning, learn_aqo and use_aqo for
- * this query to false.
+ * After auto_tuning_max_iterations steps AQO learns only on the executions
+ * which use it. Auto tuning is never switched off for the query class, so it
+ * can return to AQO when the workload changes.
  */
 void
 automatical_query_tuning(uint64 queryid, StatEntry *stat)
 {
-	double	unstability = auto_tuning_exploration;
 	double	t_aqo,
 			t_not_aqo;
-	double	p_use = -1;
 	int64	num_iterations;
 
 	num_iterations = stat->execs_with_aqo + stat->execs_without_aqo;
 	query_context.learn_aqo = true;
 	if (stat->execs_without_aqo < auto_tuning_window_size + 1)
 		query_context.use_aqo = false;
-	else if (!converged_cq(stat->est_error_aqo, stat->cur_stat_slot_aqo) &&
-			 !is_in_infinite_loop_cq(stat->est_error_aqo,
-									 stat->cur_stat_slot_aqo))
+	else if (stat->execs_with_aqo == 0 ||
+			 (!converged_cq(stat->est_error_aqo, stat->cur_stat_slot_aqo) &&
+			  !is_in_infinite_loop_cq(stat->est_error_aqo,
+									  stat->cur_stat_slot_aqo)))
 		query_context.use_aqo = true;
 	else
 	{
 		/*
 		 * Query is converged by cardinality error. Now AQO checks convergence
-		 * by execution time. It is volatile, probabilistic part of code.
-		 * XXX: this logic of auto tuning may be reworked later.
-		 */
-		t_aqo = get_estimation(stat->exec_time_aqo, stat->cur_stat_slot_aqo) +
-				get_estimation(stat->plan_time_aqo, stat->cur_stat_slot_aqo);
-
-		t_not_aqo = get_estimation(stat->exec_time, stat->cur_stat_slot) +
-					get_estimation(stat->plan_time, stat->cur_stat_slot);
-
-		p_use = t_not_aqo / (t_not_aqo + t_aqo);
-
-		/*
-		 * Here p_use<0.5 and p_use->0, if AQO decreases performance,
-		 * Otherwise, p_use>0.5 and p_use->1.
+		 * by execution time.
 		 */
-
-		p_use = 1 / (1 + exp((p_use - 0.5) / unstability));
-
-		/*
-		 * Here p_use in (0.5..max) if AQO decreases preformance.
-		 * p_use in (0..0.5), otherwise.
-		 */
-
-		p_use -= 1 / (1 + exp(-0.5 / unstability));
-		p_use /= 1 - 2 / (1 + exp(-0.5 / unstability));
-
-		/*
-		 * If our decision is using AQO for this query class, then learn on new
-		 * queries of this type. Otherwise, turn off.
-		 */
-		query_context.use_aqo = pg_prng_double(&pg_global_prng_state) < p_use;
-		query_context.learn_aqo = query_context.use_aqo;
+		t_aqo = sample_time_estimation(&stat->exec_time_avg_aqo,
+									   &stat->plan_time_avg_aqo,
+									   &stat->exec_time_avg,
+									   &stat->plan_time_avg);
+
+		t_not_aqo = sample_time_estimation(&stat->exec_time_avg,
+										   &stat->plan_time_avg,
+										   &stat->exec_time_avg_aqo,
+										   &stat->plan_time_avg_aqo);
+
+		query_context.use_aqo = t_aqo < t_not_aqo;
+		query_context.learn_aqo = query_context.use_aqo ||
+								  num_iterations <= auto_tuning_max_iterations;
 	}
 
-	if (num_iterations <= auto_tuning_max_iterations || p_use > 0.5)
-		aqo_queries_store(queryid, query_context.fspace_hash,
-						  query_context.learn_aqo, query_context.use_aqo, true,
-						  &aqo_queries_nulls);
-	else
-		aqo_queries_store(queryid,
-						  query_context.fspace_hash, false, false, false,
-						  &aqo_queries_nulls);
+	TRACE_AQO_TUNING_DECISION(queryid, num_iterations, query_context.use_aqo,
+							  query_context.learn_aqo);
+
+	aqo_queries_store(queryid, query_context.fspace_hash,
+					  query_context.learn_aqo, query_context.use_aqo, true,
+					  &aqo_queries_nulls);
 }
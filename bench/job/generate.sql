@@ -0,0 +1,196 @@
+--
+-- Deterministic generator of skewed JOB-like data for the tables of
+-- schema.sql. Values follow power-law distributions, and some columns are
+-- correlated (kind and year of a title, keywords of recent titles, gender and
+-- first name, role and note of a cast), so the planner misestimates joins in a
+-- similar way as on the real IMDB data.
+--
+-- Variables:
+--   scale - size of the data, about 300 thousands of cast_info rows per unit.
+--   seed - seed of the random generator, in the range [-1, 1].
+--
+
+\if :{?scale}
+\else
+\set scale 1
+\endif
+\if :{?seed}
+\else
+\set seed 0.42
+\endif
+
+SELECT (20000 * :scale)::integer AS ntitles,
+	   (2000 * :scale)::integer AS ncompanies,
+	   (5000 * :scale)::integer AS nkeywords,
+	   (40000 * :scale)::integer AS nnames
+\gset
+
+SELECT setseed(:seed);
+
+-- Pick an element of the array, the first ones more often with a bigger skew
+CREATE FUNCTION job_pick(arr anyarray, skew double precision)
+RETURNS anyelement AS $$
+	SELECT arr[1 + floor(array_length(arr, 1) * power(random(), skew))::integer]
+$$ LANGUAGE SQL VOLATILE;
+
+-- Random integer in [1, n], skewed to the small values
+CREATE FUNCTION job_rand(n integer, skew double precision)
+RETURNS integer AS $$
+	SELECT 1 + floor(n * power(random(), skew))::integer
+$$ LANGUAGE SQL VOLATILE;
+
+INSERT INTO kind_type VALUES
+	(1, 'movie'), (2, 'tv series'), (3, 'tv movie'), (4, 'video movie'),
+	(5, 'tv mini series'), (6, 'video game'), (7, 'episode');
+
+INSERT INTO company_type VALUES
+	(1, 'distributors'), (2, 'production companies'),
+	(3, 'special effects companies'), (4, 'miscellaneous companies');
+
+INSERT INTO role_type VALUES
+	(1, 'actor'), (2, 'actress'), (3, 'producer'), (4, 'writer'),
+	(5, 'cinematographer'), (6, 'composer'), (7, 'costume designer'),
+	(8, 'director'), (9, 'editor'), (10, 'miscellaneous crew'),
+	(11, 'production designer'), (12, 'guest');
+
+INSERT INTO info_type
+	SELECT gs, CASE gs
+				 WHEN 3 THEN 'genres'
+				 WHEN 8 THEN 'countries'
+				 WHEN 16 THEN 'release dates'
+				 WHEN 99 THEN 'votes distribution'
+				 WHEN 100 THEN 'votes'
+				 WHEN 101 THEN 'rating'
+				 WHEN 112 THEN 'top 250 rank'
+				 WHEN 113 THEN 'bottom 10 rank'
+				 ELSE 'info ' || gs END
+	FROM generate_series(1, 113) AS gs;
+
+INSERT INTO keyword
+	SELECT gs, CASE gs
+				 WHEN 1 THEN 'sequel'
+				 WHEN 2 THEN 'character-name-in-title'
+				 WHEN 3 THEN 'marvel-cinematic-universe'
+				 WHEN 4 THEN 'superhero'
+				 WHEN 5 THEN 'based-on-novel'
+				 ELSE 'keyword-' || gs END
+	FROM generate_series(1, :nkeywords) AS gs;
+
+-- Episodes are recent, movies are spread over the whole century
+INSERT INTO title
+	SELECT id, 'title-' || id, kind_id,
+		   CASE WHEN r < 0.03 THEN NULL
+				WHEN kind_id = 7 THEN 1990 + floor(30 * sqrt(r))::integer
+				ELSE 1900 + floor(120 * power(r, 0.4))::integer END
+	FROM (SELECT gs AS id, job_rand(7, 3) AS kind_id, random() AS r
+		  FROM generate_series(1, :ntitles) AS gs) AS s;
+
+INSERT INTO company_name
+	SELECT gs, 'company-' || gs,
+		   CASE WHEN random() < 0.1 THEN NULL
+				ELSE job_pick(ARRAY['[us]', '[gb]', '[de]', '[fr]', '[jp]',
+									'[it]', '[ca]', '[se]', '[in]', '[es]'], 2)
+		   END
+	FROM generate_series(1, :ncompanies) AS gs;
+
+INSERT INTO movie_companies
+	SELECT id, movie_id, company_id, company_type_id,
+		   CASE WHEN r < 0.4 THEN NULL
+				WHEN r < 0.55 THEN '(co-production)'
+				WHEN r < 0.7 THEN '(presents)'
+				WHEN r < 0.8 THEN '(USA) (TV)'
+				WHEN r < 0.88 THEN '(2006) (Japan) (theatrical)'
+				WHEN r < 0.93 THEN '(as Metro-Goldwyn-Mayer Pictures)'
+				ELSE '(' || (1950 + floor(70 * r2)::integer) ||
+					 ') (worldwide) (all media)' END
+	FROM (SELECT gs AS id, job_rand(:ntitles, 1.5) AS movie_id,
+				 job_rand(:ncompanies, 3) AS company_id,
+				 job_rand(4, 2) AS company_type_id,
+				 random() AS r, random() AS r2
+		  FROM generate_series(1, (2.5 * :ntitles)::integer) AS gs) AS s;
+
+-- Recent titles have sequels and superheroes much more often
+INSERT INTO movie_keyword
+	SELECT s.id, s.movie_id,
+		   CASE WHEN t.production_year > 2005 AND s.r < 0.1 THEN 1 + (s.id % 4)
+				ELSE s.keyword_id END
+	FROM (SELECT gs AS id, job_rand(:ntitles, 1.5) AS movie_id,
+				 job_rand(:nkeywords, 4) AS keyword_id, random() AS r
+		  FROM generate_series(1, 4 * :ntitles) AS gs OFFSET 0) AS s
+	JOIN title t ON t.id = s.movie_id;
+
+INSERT INTO movie_info
+	SELECT id, movie_id, info_type_id,
+		   CASE info_type_id
+			 WHEN 3 THEN
+				job_pick(ARRAY['Drama', 'Comedy', 'Documentary', 'Horror',
+							   'Action', 'Thriller', 'Romance', 'Sci-Fi',
+							   'Family'], 1.5)
+			 WHEN 8 THEN
+				job_pick(ARRAY['USA', 'UK', 'Germany', 'France', 'Japan',
+							   'Sweden', 'Norway', 'Denmark', 'Italy',
+							   'Canada'], 2)
+			 WHEN 16 THEN
+				job_pick(ARRAY['USA', 'UK', 'Germany', 'France', 'Japan'], 2) ||
+				':' || (1950 + floor(70 * sqrt(r))::integer)
+			 ELSE 'info-' || floor(100 * r)::integer END
+	FROM (SELECT gs AS id, job_rand(:ntitles, 1.5) AS movie_id,
+				 job_pick(ARRAY[3, 3, 8, 8, 16, 16, 1, 2, 4, 5, 6, 7], 1) AS info_type_id,
+				 random() AS r
+		  FROM generate_series(1, 6 * :ntitles) AS gs) AS s;
+
+INSERT INTO movie_info_idx
+	SELECT id, movie_id, info_type_id,
+		   CASE info_type_id
+			 WHEN 101 THEN to_char(1 + 9 * power(r, 0.7), 'FM9.0')
+			 WHEN 100 THEN floor(1000000 * power(r, 3))::integer::text
+			 WHEN 112 THEN (1 + floor(250 * r))::integer::text
+			 WHEN 113 THEN (1 + floor(10 * r))::integer::text
+			 ELSE '..' || floor(10 * r)::integer || '.' END
+	FROM (SELECT gs AS id, job_rand(:ntitles, 1.5) AS movie_id,
+				 job_pick(ARRAY[101, 101, 100, 100, 99, 112, 113], 1) AS info_type_id,
+				 random() AS r
+		  FROM generate_series(1, (1.5 * :ntitles)::integer) AS gs) AS s;
+
+INSERT INTO name
+	SELECT id, surname || ', ' || firstname,
+		   CASE WHEN r < 0.05 THEN NULL
+				WHEN firstname IN ('Mary', 'Yoko', 'Yuki', 'Anna', 'Ingrid',
+								   'Maria') THEN 'f'
+				ELSE 'm' END
+	FROM (SELECT gs AS id,
+				 job_pick(ARRAY['Smith', 'Johnson', 'Brown', 'Tanaka', 'Downey',
+								'Yamada', 'Suzuki', 'Muller', 'Schmidt',
+								'Bergman', 'Lee', 'Garcia', 'Williams', 'Jones',
+								'Miller'], 1.5) AS surname,
+				 job_pick(ARRAY['John', 'Robert', 'Mary', 'Yoko', 'Michael',
+								'Yuki', 'Anna', 'Hans', 'Ingrid', 'James',
+								'Maria', 'Kenji'], 1.5) AS firstname,
+				 random() AS r
+		  FROM generate_series(1, :nnames) AS gs) AS s;
+
+INSERT INTO cast_info
+	SELECT id, person_id, movie_id, role_id,
+		   CASE WHEN role_id = 2 AND r < 0.2 THEN '(voice: English version)'
+				WHEN role_id IN (1, 2) AND r < 0.3 THEN '(voice)'
+				WHEN role_id = 3 AND r < 0.7 THEN '(producer)'
+				WHEN r < 0.35 THEN '(uncredited)'
+				ELSE NULL END
+	FROM (SELECT gs AS id, job_rand(:nnames, 2) AS person_id,
+				 job_rand(:ntitles, 1.5) AS movie_id,
+				 job_rand(12, 2) AS role_id, random() AS r
+		  FROM generate_series(1, 12 * :ntitles) AS gs) AS s;
+
+DROP FUNCTION job_pick(anyarray, double precision);
+DROP FUNCTION job_rand(integer, double precision);
+
+CREATE INDEX ON movie_companies (movie_id);
+CREATE INDEX ON movie_companies (company_id);
+CREATE INDEX ON movie_keyword (movie_id);
+CREATE INDEX ON movie_keyword (keyword_id);
+CREATE INDEX ON movie_info (movie_id);
+CREATE INDEX ON movie_info_idx (movie_id);
+CREATE INDEX ON cast_info (movie_id);
+CREATE INDEX ON cast_info (person_id);
+
+VACUUM ANALYZE;
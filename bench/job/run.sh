@@ -0,0 +1,150 @@
+#!/bin/bash
+
+# ##############################################################################
+#
+# Offline Join Order Benchmark. Generates JOB-like schema and data locally and
+# passes the queries from the queries directory through several AQO learning
+# passes. The instance is specified by the usual libpq environment variables
+# (PGHOST, PGPORT, PGDATABASE, ...), the aqo library must be preloaded.
+#
+# Environment variables:
+# AQO_JOB_SCALE - scale of the generated data (1 by default);
+# AQO_JOB_SEED - seed of the data generator, in the range [-1, 1];
+# AQO_JOB_PASSES - number of learning passes (10 by default);
+# AQO_JOB_EPS - cardinality error change, small enough to consider the query
+#   converged (0.05 by default);
+# AQO_JOB_LOAD - set to 'off' to reuse the data, generated before;
+# AQO_JOB_RESULTS - directory for the results (job_results by default).
+#
+# Results:
+# - report.tsv - execution time and cardinality error of each query on each
+#   pass. Pass 0 is made with AQO disabled;
+# - summary.tsv - for each query: time and error without AQO and after the
+#   last pass and the pass, since which the error doesn't change more than
+#   AQO_JOB_EPS (-1, if the query didn't converge);
+# - explains.txt - explain of each query execution.
+#
+# ##############################################################################
+
+set -e
+
+JOB_DIR=$(cd "$(dirname "$0")" && pwd)
+SCALE=${AQO_JOB_SCALE:-1}
+SEED=${AQO_JOB_SEED:-0.42}
+PASSES=${AQO_JOB_PASSES:-10}
+EPS=${AQO_JOB_EPS:-0.05}
+RESULTS=${AQO_JOB_RESULTS:-job_results}
+
+export PGOPTIONS="$PGOPTIONS -c compute_query_id=on -c aqo.join_threshold=0"
+
+mkdir -p "$RESULTS"
+echo -e "query\tqueryid\tpass\tmode\texecution_time_ms\tcardinality_error" \
+  > "$RESULTS/report.tsv"
+echo -n "" > "$RESULTS/explains.txt"
+
+if [ "$AQO_JOB_LOAD" != "off" ]
+then
+  echo "Generate JOB-like data with scale $SCALE and seed $SEED"
+  psql -q -v ON_ERROR_STOP=1 -f "$JOB_DIR/schema.sql"
+  psql -q -v ON_ERROR_STOP=1 -v scale="$SCALE" -v seed="$SEED" \
+    -f "$JOB_DIR/generate.sql"
+fi
+
+psql -q -c "CREATE EXTENSION IF NOT EXISTS aqo"
+psql -q -c "SELECT aqo_reset()" > /dev/null
+
+# Execute the query and print execution time and cardinality error
+run_query()
+{
+  local file=$1
+  local queryid=$2
+  local mode=$3
+  local controlled=true
+  local collect=off
+  local result
+  local exec_time
+  local error
+
+  if [ "$mode" = "disabled" ]
+  then
+    controlled=false
+    collect=on
+  fi
+
+  result=$(psql -qAt -v ON_ERROR_STOP=1 <<EOF
+SET aqo.mode = '$mode';
+SET aqo.force_collect_stat = '$collect';
+EXPLAIN (ANALYZE, FORMAT JSON) $(cat "$file")
+EOF
+)
+  echo "$result" >> "$RESULTS/explains.txt"
+  exec_time=$(echo $result | sed -n 's/.*"Execution Time": \([0-9]*\.[0-9]*\).*/\1/p')
+  error=$(psql -qAt -c "
+    SELECT error FROM aqo_cardinality_error($controlled) WHERE id = $queryid")
+
+  echo -e "$exec_time\t$error"
+}
+
+for file in "$JOB_DIR"/queries/*.sql
+do
+  query=$(basename "$file" .sql)
+  queryid=$(psql -qAt -c "EXPLAIN (VERBOSE, COSTS OFF) $(cat "$file")" |
+            sed -n 's/^Query Identifier: \(-\?[0-9]*\)$/\1/p')
+
+  for (( pass=0; pass<=$PASSES; pass++ ))
+  do
+    if [ $pass -eq 0 ]
+    then
+      mode=disabled
+    else
+      mode=learn
+    fi
+
+    res=$(run_query "$file" "$queryid" $mode)
+    echo -e "$query\t$queryid\t$pass\t$mode\t$res" >> "$RESULTS/report.tsv"
+    echo -e "$query\t$pass\t$mode\t$res"
+
+    if [ $pass -eq 0 ]
+    then
+      # The class was registered with AQO disabled, switch learning on
+      psql -qAt -c "SELECT aqo_enable_class($queryid)" > /dev/null
+    fi
+  done
+done
+
+# Summary on each query
+awk -F'\t' -v eps="$EPS" -v passes="$PASSES" '
+  function abs(x) { return x < 0 ? -x : x }
+  NR == 1 { next }
+  {
+    q = $1
+    if (!(q in seen)) { seen[q] = 1; order[++n] = q }
+    time[q, $3] = $5
+    err[q, $3] = $6
+  }
+  END {
+    print "query\texecution_time_ms_without_aqo\texecution_time_ms\t" \
+          "cardinality_error_without_aqo\tcardinality_error\tconvergence_pass"
+    for (i = 1; i <= n; i++)
+    {
+      q = order[i]
+      converged = -1
+      for (p = passes; p >= 1; p--)
+      {
+        stable = 1
+        for (r = p + 1; r <= passes; r++)
+          if (abs(err[q, r] - err[q, p]) > eps)
+            stable = 0
+        if (!stable)
+          break
+        converged = p
+      }
+      # The last pass alone says nothing about the convergence
+      if (converged == passes)
+        converged = -1
+      print q "\t" time[q, 0] "\t" time[q, passes] "\t" err[q, 0] "\t" \
+            err[q, passes] "\t" converged
+    }
+  }' "$RESULTS/report.tsv" > "$RESULTS/summary.tsv"
+
+column -t -s $'\t' "$RESULTS/summary.tsv"
@@ -0,0 +1,89 @@
+--
+-- Schema of the offline Join Order Benchmark: a subset of the IMDB schema,
+-- used by the JOB queries. See generate.sql for the data.
+--
+
+DROP TABLE IF EXISTS
+	kind_type, info_type, company_type, role_type, title, company_name,
+	movie_companies, keyword, movie_keyword, movie_info, movie_info_idx,
+	name, cast_info CASCADE;
+
+CREATE TABLE kind_type (
+	id				integer PRIMARY KEY,
+	kind			varchar(15) NOT NULL
+);
+
+CREATE TABLE info_type (
+	id				integer PRIMARY KEY,
+	info			varchar(32) NOT NULL
+);
+
+CREATE TABLE company_type (
+	id				integer PRIMARY KEY,
+	kind			varchar(32) NOT NULL
+);
+
+CREATE TABLE role_type (
+	id				integer PRIMARY KEY,
+	role			varchar(32) NOT NULL
+);
+
+CREATE TABLE title (
+	id				integer PRIMARY KEY,
+	title			text NOT NULL,
+	kind_id			integer NOT NULL,
+	production_year	integer
+);
+
+CREATE TABLE company_name (
+	id				integer PRIMARY KEY,
+	name			text NOT NULL,
+	country_code	varchar(255)
+);
+
+CREATE TABLE movie_companies (
+	id				integer PRIMARY KEY,
+	movie_id		integer NOT NULL,
+	company_id		integer NOT NULL,
+	company_type_id	integer NOT NULL,
+	note			text
+);
+
+CREATE TABLE keyword (
+	id				integer PRIMARY KEY,
+	keyword			text NOT NULL
+);
+
+CREATE TABLE movie_keyword (
+	id				integer PRIMARY KEY,
+	movie_id		integer NOT NULL,
+	keyword_id		integer NOT NULL
+);
+
+CREATE TABLE movie_info (
+	id				integer PRIMARY KEY,
+	movie_id		integer NOT NULL,
+	info_type_id	integer NOT NULL,
+	info			text NOT NULL
+);
+
+CREATE TABLE movie_info_idx (
+	id				integer PRIMARY KEY,
+	movie_id		integer NOT NULL,
+	info_type_id	integer NOT NULL,
+	info			text NOT NULL
+);
+
+CREATE TABLE name (
+	id				integer PRIMARY KEY,
+	name			text NOT NULL,
+	gender			varchar(1)
+);
+
+CREATE TABLE cast_info (
+	id				integer PRIMARY KEY,
+	person_id		integer NOT NULL,
+	movie_id		integer NOT NULL,
+	role_id			integer NOT NULL,
+	note			text
+);
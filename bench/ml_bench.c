@@ -0,0 +1,329 @@
+/*
+ *******************************************************************************
+ *
+ *	STANDALONE BENCHMARK OF THE MACHINE LEARNING CORE
+ *
+ * Measures OkNNr_predict(), OkNNr_learn() and compute_weights() outside of a
+ * server for different numbers of rows and columns of the matrix and
+ * different aqo_k. The ML module doesn't know anything about DBMS, so it is
+ * compiled here with the minimal stubs of postgres.h.
+ *
+ * Usage: ml_bench [-f csv|json] [-t target_ms] [-s seed]
+ *
+ * Each line of the output describes one operation with one set of
+ * parameters: time per operation in nanoseconds and number and size of
+ * allocations per operation.
+ *
+ *******************************************************************************
+ *
+ * Copyright (c) 2016-2022, Postgres Professional
+ *
+ * IDENTIFICATION
+ *	  aqo/bench/ml_bench.c
+ *
+ */
+
+#include "postgres.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Static functions of the ML core are benchmarked too */
+#include "machine_learning.c"
+
+
+/* Number of prepared feature vectors, used in turn by the operations */
+#define NFEATURES			(64)
+
+/* Restore the matrix after so many learning steps to keep it stable */
+#define LEARN_RESTORE_STEPS	(256)
+
+typedef enum
+{
+	BENCH_PREDICT,
+	BENCH_LEARN,
+	BENCH_WEIGHTS
+} BenchOp;
+
+static const char *op_names[] = {"predict", "learn", "compute_weights"};
+
+static const int bench_rows[] = {1, 10, aqo_K};
+static const int bench_cols[] = {1, 4, 16, 64};
+static const int bench_k[] = {1, 3, 5, 10, aqo_K};
+
+#define lengthof(array) (sizeof(array) / sizeof(array[0]))
+
+/* Parameters of the ML core, defined by GUCs in the server */
+int			aqo_k = 3;
+bool		aqo_predict_with_few_neighbors = true;
+
+static uint64_t nallocs = 0;
+static uint64_t nalloc_bytes = 0;
+static uint64_t rng_state;
+
+
+void *
+palloc(size_t size)
+{
+	void   *pointer = malloc(size);
+
+	if (pointer == NULL)
+	{
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	nallocs++;
+	nalloc_bytes += size;
+	return pointer;
+}
+
+void *
+palloc0(size_t size)
+{
+	void   *pointer = palloc(size);
+
+	memset(pointer, 0, size);
+	return pointer;
+}
+
+void
+pfree(void *pointer)
+{
+	free(pointer);
+}
+
+void
+bench_elog(int elevel pg_attribute_unused(), const char *fmt, ...)
+{
+	va_list		args;
+
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fputc('\n', stderr);
+}
+
+/*
+ * xorshift64*: the benchmark must be reproducible with the same seed.
+ */
+static double
+random_double(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return (double) ((rng_state * UINT64_C(2685821657736338717)) >> 11) /
+		(double) (UINT64_C(1) << 53);
+}
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+fill_data(OkNNrdata *data, int nrows)
+{
+	int		i;
+	int		j;
+
+	data->rows = nrows;
+	for (i = 0; i < nrows; i++)
+	{
+		for (j = 0; j < data->cols; j++)
+			data->matrix[i][j] = random_double() * 10.;
+		data->targets[i] = random_double() * 20.;
+		data->rfactors[i] = RELIABILITY_MIN +
+			random_double() * (RELIABILITY_MAX - RELIABILITY_MIN);
+	}
+}
+
+static void
+copy_data(OkNNrdata *dst, OkNNrdata *src)
+{
+	int		i;
+
+	dst->rows = src->rows;
+	for (i = 0; i < src->rows; i++)
+	{
+		memcpy(dst->matrix[i], src->matrix[i], sizeof(double) * src->cols);
+		dst->targets[i] = src->targets[i];
+		dst->rfactors[i] = src->rfactors[i];
+	}
+}
+
+/*
+ * Run the operation niters times. Returns elapsed time in nanoseconds.
+ */
+static uint64_t
+run_op(BenchOp op, OkNNrdata *data, OkNNrdata *origin,
+	   double **features, double *distances, uint64_t niters)
+{
+	double		w[aqo_K];
+	int			idx[aqo_K];
+	double		sink = 0.;
+	uint64_t	start = now_ns();
+	uint64_t	i;
+
+	for (i = 0; i < niters; i++)
+	{
+		double *f = features[i % NFEATURES];
+
+		switch (op)
+		{
+			case BENCH_PREDICT:
+				sink += OkNNr_predict(data, f);
+				break;
+			case BENCH_LEARN:
+				if (i % LEARN_RESTORE_STEPS == 0)
+					copy_data(data, origin);
+				/* Don't let the matrix grow, learn on the same state */
+				data->rows = origin->rows;
+				sink += OkNNr_learn(data, f, f[0] * 2., RELIABILITY_MAX);
+				break;
+			case BENCH_WEIGHTS:
+				sink += compute_weights(&distances[i % NFEATURES], data->rows,
+										w, idx);
+				break;
+		}
+	}
+
+	/* Don't allow the compiler to throw the calls away */
+	if (sink == -1.)
+		fputc(' ', stderr);
+
+	return now_ns() - start;
+}
+
+static void
+bench_one(BenchOp op, int nrows, int ncols, uint64_t target_ns, bool json)
+{
+	OkNNrdata  *origin = OkNNr_allocate(ncols);
+	OkNNrdata  *data = OkNNr_allocate(ncols);
+	double	   *features[NFEATURES];
+	double		distances[NFEATURES + aqo_K];
+	uint64_t	niters = 16;
+	uint64_t	elapsed;
+	uint64_t	allocs;
+	uint64_t	alloc_bytes;
+	int			i;
+	int			j;
+
+	fill_data(origin, nrows);
+	copy_data(data, origin);
+
+	for (i = 0; i < NFEATURES; i++)
+	{
+		features[i] = palloc(sizeof(double) * ncols);
+		for (j = 0; j < ncols; j++)
+			features[i][j] = random_double() * 10.;
+	}
+	for (i = 0; i < NFEATURES + aqo_K; i++)
+		distances[i] = random_double() * 10.;
+
+	/* Find the number of iterations which takes at least the target time */
+	for (;;)
+	{
+		elapsed = run_op(op, data, origin, features, distances, niters);
+		if (elapsed >= target_ns || niters >= UINT64_C(1) << 40)
+			break;
+		niters *= 2;
+	}
+
+	allocs = nallocs;
+	alloc_bytes = nalloc_bytes;
+	copy_data(data, origin);
+	elapsed = run_op(op, data, origin, features, distances, niters);
+	allocs = nallocs - allocs;
+	alloc_bytes = nalloc_bytes - alloc_bytes;
+
+	if (json)
+		printf("{\"op\": \"%s\", \"rows\": %d, \"cols\": %d, \"k\": %d, "
+			   "\"iterations\": %llu, \"ns_per_op\": %.2f, "
+			   "\"allocs_per_op\": %.4f, \"alloc_bytes_per_op\": %.2f}\n",
+			   op_names[op], nrows, ncols, aqo_k,
+			   (unsigned long long) niters, (double) elapsed / niters,
+			   (double) allocs / niters, (double) alloc_bytes / niters);
+	else
+		printf("%s,%d,%d,%d,%llu,%.2f,%.4f,%.2f\n",
+			   op_names[op], nrows, ncols, aqo_k,
+			   (unsigned long long) niters, (double) elapsed / niters,
+			   (double) allocs / niters, (double) alloc_bytes / niters);
+
+	for (i = 0; i < NFEATURES; i++)
+		pfree(features[i]);
+	for (i = 0; i < aqo_K; i++)
+	{
+		pfree(origin->matrix[i]);
+		pfree(data->matrix[i]);
+	}
+	pfree(origin);
+	pfree(data);
+}
+
+int
+main(int argc, char **argv)
+{
+	bool		json = false;
+	uint64_t	target_ms = 10;
+	uint64_t	seed = 42;
+	int			c;
+	size_t		r;
+	size_t		l;
+	size_t		k;
+	int			op;
+
+	while ((c = getopt(argc, argv, "f:t:s:")) != -1)
+	{
+		switch (c)
+		{
+			case 'f':
+				if (strcmp(optarg, "json") == 0)
+					json = true;
+				else if (strcmp(optarg, "csv") != 0)
+				{
+					fprintf(stderr, "unknown output format \"%s\"\n", optarg);
+					return 1;
+				}
+				break;
+			case 't':
+				target_ms = strtoull(optarg, NULL, 10);
+				break;
+			case 's':
+				seed = strtoull(optarg, NULL, 10);
+				break;
+			default:
+				fprintf(stderr,
+						"usage: %s [-f csv|json] [-t target_ms] [-s seed]\n",
+						argv[0]);
+				return 1;
+		}
+	}
+
+	rng_state = (seed != 0) ? seed : 1;
+
+	if (!json)
+		printf("op,rows,cols,k,iterations,ns_per_op,allocs_per_op,"
+			   "alloc_bytes_per_op\n");
+
+	for (op = BENCH_PREDICT; op <= BENCH_WEIGHTS; op++)
+		for (r = 0; r < lengthof(bench_rows); r++)
+			for (l = 0; l < lengthof(bench_cols); l++)
+				for (k = 0; k < lengthof(bench_k); k++)
+				{
+					aqo_k = bench_k[k];
+					bench_one((BenchOp) op, bench_rows[r], bench_cols[l],
+							  target_ms * 1000000, json);
+				}
+
+	return 0;
+}
@@ -0,0 +1,39 @@
+/*
+ * Minimal replacement of the PostgreSQL environment for the standalone
+ * benchmark of the machine learning core (see ml_bench.c). Only the things,
+ * used by machine_learning.c, are defined here.
+ *
+ * Copyright (c) 2016-2022, Postgres Professional
+ *
+ * IDENTIFICATION
+ *	  aqo/bench/postgres.h
+ */
+#ifndef AQO_BENCH_POSTGRES_H
+#define AQO_BENCH_POSTGRES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef unsigned int Oid;
+
+#define WARNING		19
+
+#ifdef USE_ASSERT_CHECKING
+#include <assert.h>
+#define Assert(condition)	assert(condition)
+#else
+#define Assert(condition)	((void) true)
+#endif
+
+#define pg_attribute_printf(f,a)	__attribute__((format(printf, f, a)))
+#define pg_attribute_unused()	__attribute__((unused))
+
+#define elog(elevel, ...)	bench_elog(elevel, __VA_ARGS__)
+
+extern void *palloc(size_t size);
+extern void *palloc0(size_t size);
+extern void pfree(void *pointer);
+extern void bench_elog(int elevel, const char *fmt, ...) pg_attribute_printf(2, 3);
+
+#endif							/* AQO_BENCH_POSTGRES_H */
@@ -20,8 +20,11 @@
 #include "optimizer/optimizer.h"
 
 #include "aqo.h"
+#include "aqo_trace.h"
+#include "counters.h"
 #include "hash.h"
 #include "machine_learning.h"
+#include "path_utils.h"
 #include "storage.h"
 
 
@@ -69,6 +72,10 @@ predict_for_relation(List *clauses, List *selectivities, List *relsigns,
 	double		result;
 	int			ncols;
 	OkNNrdata  *data;
+	bool		wide_search = use_wide_search &&
+							  !AQO_PLANNING_DEGRADED(AQO_DEGRADE_WIDE_SEARCH);
+	AqoPredictionSource source = AQO_PRED_EXACT;
+	instr_time	start;
 
 	if (relsigns == NIL)
 		/*
@@ -77,8 +84,13 @@ predict_for_relation(List *clauses, List *selectivities, List *relsigns,
 		 */
 		return -4.;
 
+	INSTR_TIME_SET_ZERO(start);
+	if (aqo_show_provenance || TRACE_AQO_PREDICTION_DONE_ENABLED())
+		INSTR_TIME_SET_CURRENT(start);
+
 	*fss = get_fss_for_object(relsigns, clauses, selectivities,
 							  &ncols, &features);
+	TRACE_AQO_PREDICTION_START(query_context.fspace_hash, *fss);
 	data = OkNNr_allocate(ncols);
 
 	if (load_fss_ext(query_context.fspace_hash, *fss, data, NULL))
@@ -93,23 +105,49 @@ predict_for_relation(List *clauses, List *selectivities, List *relsigns,
 		 */
 
 		/* Try to search in surrounding feature spaces for the same node */
-		if (!load_aqo_data(query_context.fspace_hash, *fss, data, NULL, use_wide_search, features))
+		if (!load_aqo_data(query_context.fspace_hash, *fss, data, NULL,
+						   wide_search, features))
+		{
+			source = AQO_PRED_MISS;
 			result = -1;
+		}
 		else
 		{
 			elog(DEBUG5, "[AQO] Make prediction for fss %d by a neighbour "
 				 "includes %d feature(s) and %d fact(s).",
 				 *fss, data->cols, data->rows);
+			if (wide_search)
+				source = AQO_PRED_WIDE;
 			result = OkNNr_predict(data, features);
 		}
 	}
 
+	if (source != AQO_PRED_MISS && !aqo_predict_with_few_neighbors &&
+		data->rows < aqo_k)
+		source = AQO_PRED_FEW_NEIGHBORS;
+	aqo_prediction_count(source);
+
+	if (aqo_show_provenance)
+	{
+		bool	found = (source != AQO_PRED_MISS);
+
+		prediction_details_store(*fss,
+								 (result < 0) ? AQO_SOURCE_FALLBACK :
+								 (source == AQO_PRED_WIDE) ? AQO_SOURCE_WIDE :
+															 AQO_SOURCE_EXACT,
+								 found ? data->rows : 0,
+								 found ? OkNNr_nearest_distance(data, features) : -1.,
+								 &start);
+	}
+
 #ifdef AQO_DEBUG_PRINT
 	predict_debug_output(clauses, selectivities, relsigns, *fss, result);
 #endif
 
-	if (result < 0)
-		return -1;
-	else
-		return clamp_row_est(exp(result));
+	result = (result < 0) ? -1 : clamp_row_est(exp(result));
+
+	if (TRACE_AQO_PREDICTION_DONE_ENABLED() && !INSTR_TIME_IS_ZERO(start))
+		TRACE_AQO_PREDICTION_DONE(query_context.fspace_hash, *fss,
+								  (int64) result, aqo_trace_elapsed(start));
+	return result;
 }
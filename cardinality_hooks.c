@@ -29,6 +29,7 @@
 
 #include "aqo.h"
 #include "cardinality_hooks.h"
+#include "counters.h"
 #include "hash.h"
 #include "machine_learning.h"
 #include "path_utils.h"
@@ -39,6 +40,35 @@ double predicted_ppi_rows;
 double fss_ppi_hash;
 
 
+/*
+ * Account time, spent in AQO estimation hooks during the query planning.
+ * It is needed for the planning overhead budget and the aqo_overhead view only.
+ */
+static inline void
+start_predict_timer(instr_time *start)
+{
+	if (aqo_planning_overhead_limit > 0. || aqo_track_overhead)
+		INSTR_TIME_SET_CURRENT(*start);
+	else
+		INSTR_TIME_SET_ZERO(*start);
+}
+
+static inline void
+stop_predict_timer(instr_time *start, AqoHook hook)
+{
+	instr_time	now;
+
+	if (INSTR_TIME_IS_ZERO(*start))
+		return;
+
+	INSTR_TIME_SET_CURRENT(now);
+	INSTR_TIME_SUBTRACT(now, *start);
+	INSTR_TIME_ADD(query_context.predict_time, now);
+
+	if (aqo_track_overhead)
+		aqo_overhead_add(hook, now, true);
+}
+
 /*
  * Calls standard set_baserel_rows_estimate or its previous hook.
  */
@@ -145,11 +175,13 @@ aqo_set_baserel_rows_estimate(PlannerInfo *root, RelOptInfo *rel)
 	List		   *clauses;
 	int				fss = 0;
 	MemoryContext old_ctx_m;
+	instr_time		start;
 
 	if (IsQueryDisabled())
 		/* Fast path. */
 		goto default_estimator;
 
+	start_predict_timer(&start);
 	old_ctx_m = MemoryContextSwitchTo(AQOPredictMemCtx);
 
 	if (query_context.use_aqo || query_context.learn_aqo)
@@ -159,6 +191,7 @@ aqo_set_baserel_rows_estimate(PlannerInfo *root, RelOptInfo *rel)
 	if (!query_context.use_aqo)
 	{
 		MemoryContextSwitchTo(old_ctx_m);
+		stop_predict_timer(&start, AQO_HOOK_BASEREL_ROWS);
 		goto default_estimator;
 	}
 
@@ -177,6 +210,7 @@ aqo_set_baserel_rows_estimate(PlannerInfo *root, RelOptInfo *rel)
 
 	/* Return to the caller's memory context. */
 	MemoryContextSwitchTo(old_ctx_m);
+	stop_predict_timer(&start, AQO_HOOK_BASEREL_ROWS);
 
 	if (predicted >= 0)
 	{
@@ -224,11 +258,13 @@ aqo_get_parameterized_baserel_size(PlannerInfo *root,
 	int			current_hash;
 	int			fss = 0;
 	MemoryContext oldctx;
+	instr_time	start;
 
 	if (IsQueryDisabled())
 		/* Fast path */
 		goto default_estimator;
 
+	start_predict_timer(&start);
 	oldctx = MemoryContextSwitchTo(AQOPredictMemCtx);
 
 	if (query_context.use_aqo || query_context.learn_aqo)
@@ -261,10 +297,22 @@ aqo_get_parameterized_baserel_size(PlannerInfo *root,
 	if (!query_context.use_aqo)
 	{
 		MemoryContextSwitchTo(oldctx);
+		stop_predict_timer(&start, AQO_HOOK_PARAM_BASEREL_SIZE);
 
 		goto default_estimator;
 	}
 
+	if (AQO_PLANNING_DEGRADED(AQO_DEGRADE_PARAM_PATHS))
+	{
+		/* Selectivities are cached for learning, but don't predict */
+		MemoryContextSwitchTo(oldctx);
+		stop_predict_timer(&start, AQO_HOOK_PARAM_BASEREL_SIZE);
+
+		predicted_ppi_rows = -1.;
+		fss_ppi_hash = 0;
+		goto default_estimator;
+	}
+
 	if (rte && OidIsValid(rte->relid))
 	{
 		/* Predict for a plane table. */
@@ -276,6 +324,7 @@ aqo_get_parameterized_baserel_size(PlannerInfo *root,
 
 	/* Return to the caller's memory context */
 	MemoryContextSwitchTo(oldctx);
+	stop_predict_timer(&start, AQO_HOOK_PARAM_BASEREL_SIZE);
 
 	predicted_ppi_rows = predicted;
 	fss_ppi_hash = fss;
@@ -309,12 +358,21 @@ aqo_set_joinrel_size_estimates(PlannerInfo *root, RelOptInfo *rel,
 	List	   *outer_selectivities;
 	List	   *current_selectivities = NULL;
 	int			fss = 0;
+	int			nrels;
 	MemoryContext old_ctx_m;
+	instr_time	start;
 
 	if (IsQueryDisabled())
 		/* Fast path */
 		goto default_estimator;
 
+	nrels = bms_num_members(rel->relids);
+	if (AQO_PLANNING_DEGRADED(AQO_DEGRADE_JOIN_LIMIT) &&
+		query_context.join_limit > 0 && nrels > query_context.join_limit)
+		/* Too expensive to predict for the query class */
+		goto default_estimator;
+
+	start_predict_timer(&start);
 	old_ctx_m = MemoryContextSwitchTo(AQOPredictMemCtx);
 
 	if (query_context.use_aqo || query_context.learn_aqo)
@@ -323,9 +381,12 @@ aqo_set_joinrel_size_estimates(PlannerInfo *root, RelOptInfo *rel,
 	if (!query_context.use_aqo)
 	{
 		MemoryContextSwitchTo(old_ctx_m);
+		stop_predict_timer(&start, AQO_HOOK_JOINREL_SIZE);
 		goto default_estimator;
 	}
 
+	query_context.max_join_rels = Max(query_context.max_join_rels, nrels);
+
 	get_list_of_relids(root, rel->relids, &rels);
 	outer_clauses = get_path_clauses(outer_rel->cheapest_total_path, root,
 									 &outer_selectivities);
@@ -342,6 +403,7 @@ aqo_set_joinrel_size_estimates(PlannerInfo *root, RelOptInfo *rel,
 
 	/* Return to the caller's memory context */
 	MemoryContextSwitchTo(old_ctx_m);
+	stop_predict_timer(&start, AQO_HOOK_JOINREL_SIZE);
 
 	rel->fss_hash = fss;
 
@@ -383,11 +445,22 @@ aqo_get_parameterized_joinrel_size(PlannerInfo *root,
 	List	   *current_selectivities = NULL;
 	int			fss = 0;
 	MemoryContext old_ctx_m;
+	instr_time	start;
 
 	if (IsQueryDisabled())
 		/* Fast path */
 		goto default_estimator;
 
+	if (query_context.use_aqo &&
+		AQO_PLANNING_DEGRADED(AQO_DEGRADE_PARAM_PATHS))
+	{
+		/* Too expensive to predict for the query class */
+		predicted_ppi_rows = -1.;
+		fss_ppi_hash = 0;
+		goto default_estimator;
+	}
+
+	start_predict_timer(&start);
 	old_ctx_m = MemoryContextSwitchTo(AQOPredictMemCtx);
 
 	if (query_context.use_aqo || query_context.learn_aqo)
@@ -397,6 +470,7 @@ aqo_get_parameterized_joinrel_size(PlannerInfo *root,
 	if (!query_context.use_aqo)
 	{
 		MemoryContextSwitchTo(old_ctx_m);
+		stop_predict_timer(&start, AQO_HOOK_PARAM_JOINREL_SIZE);
 		goto default_estimator;
 	}
 
@@ -413,6 +487,7 @@ aqo_get_parameterized_joinrel_size(PlannerInfo *root,
 									 &fss);
 	/* Return to the caller's memory context */
 	MemoryContextSwitchTo(old_ctx_m);
+	stop_predict_timer(&start, AQO_HOOK_PARAM_JOINREL_SIZE);
 
 	predicted_ppi_rows = predicted;
 	fss_ppi_hash = fss;
@@ -433,6 +508,7 @@ predict_num_groups(PlannerInfo *root, Path *subpath, List *group_exprs,
 	int			child_fss = 0;
 	double		prediction;
 	OkNNrdata	data;
+	instr_time	start;
 
 	if (subpath->parent->predicted_cardinality > 0.)
 		/* A fast path. Here we can use a fss hash of a leaf. */
@@ -449,14 +525,27 @@ predict_num_groups(PlannerInfo *root, Path *subpath, List *group_exprs,
 									&child_fss);
 	}
 
-	*fss = get_grouped_exprs_hash(child_fss, group_exprs);
+	if (aqo_show_provenance)
+		INSTR_TIME_SET_CURRENT(start);
+
+	*fss = get_grouped_exprs_hash(child_fss,
+								  get_grouping_exprs_hash(group_exprs));
 	memset(&data, 0, sizeof(OkNNrdata));
 
 	if (!load_fss_ext(query_context.fspace_hash, *fss, &data, NULL))
+	{
+		aqo_prediction_count(AQO_PRED_MISS);
+		prediction_details_store(*fss, AQO_SOURCE_FALLBACK, 0, -1., &start);
 		return -1;
+	}
 
+	aqo_prediction_count(AQO_PRED_EXACT);
 	Assert(data.rows == 1);
 	prediction = exp(data.targets[0]);
+	prediction_details_store(*fss,
+							 (prediction <= 0) ? AQO_SOURCE_FALLBACK :
+												 AQO_SOURCE_GROUPS,
+							 data.rows, -1., &start);
 	return (prediction <= 0) ? -1 : prediction;
 }
 
@@ -468,6 +557,7 @@ aqo_estimate_num_groups_hook(PlannerInfo *root, List *groupExprs,
 	int fss;
 	double predicted;
 	MemoryContext old_ctx_m;
+	instr_time start;
 
 	if (!query_context.use_aqo)
 		goto default_estimator;
@@ -486,6 +576,7 @@ aqo_estimate_num_groups_hook(PlannerInfo *root, List *groupExprs,
 	if (groupExprs == NIL)
 		return 1.0;
 
+	start_predict_timer(&start);
 	old_ctx_m = MemoryContextSwitchTo(AQOPredictMemCtx);
 
 	predicted = predict_num_groups(root, subpath, groupExprs, &fss);
@@ -495,6 +586,7 @@ aqo_estimate_num_groups_hook(PlannerInfo *root, List *groupExprs,
 		grouped_rel->rows = predicted;
 		grouped_rel->fss_hash = fss;
 		MemoryContextSwitchTo(old_ctx_m);
+		stop_predict_timer(&start, AQO_HOOK_NUM_GROUPS);
 		return predicted;
 	}
 	else
@@ -505,6 +597,7 @@ aqo_estimate_num_groups_hook(PlannerInfo *root, List *groupExprs,
 		grouped_rel->predicted_cardinality = -1;
 
 	MemoryContextSwitchTo(old_ctx_m);
+	stop_predict_timer(&start, AQO_HOOK_NUM_GROUPS);
 
 default_estimator:
 	return default_estimate_num_groups(root, groupExprs, subpath, grouped_rel,
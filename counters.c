@@ -0,0 +1,992 @@
+/*
+ *******************************************************************************
+ *
+ *	OVERHEAD AND PREDICTION COUNTERS
+ *
+ * The backend counts in local counters:
+ * - calls and time of each AQO hook, if aqo.track_overhead is enabled;
+ * - outcomes of cardinality predictions: found in the feature space of the
+ *   query, found by the wide search, refused because of too few neighbours or
+ *   missed, as well as lengths of the wide search scans and collisions of
+ *   feature subspace hashes.
+ * At the end of an execution prediction counters are added to the total ones,
+ * kept in atomic variables. With aqo.track_overhead, all the counters are also
+ * added to the entry of the query class in a shared hash table; otherwise the
+ * hash table isn't touched at all. The counters aren't persisted: a restart of
+ * the instance or the reset functions clear them. If the table is full,
+ * counters of new classes are added to the total ones only.
+ *
+ * Besides, acquisitions of the AQO locks and allocations in the DSA areas of
+ * the storage are counted in shared memory directly. Time is measured only
+ * for acquisitions, which had to wait for the lock.
+ * With aqo.track_overhead, the backend also remembers peak sizes of its
+ * prediction, learning and cache memory contexts. They are local to the
+ * backend and are shown by aqo_memory_peaks().
+ *
+ *******************************************************************************
+ *
+ * Copyright (c) 2016-2022, Postgres Professional
+ *
+ * IDENTIFICATION
+ *	  aqo/counters.c
+ *
+ */
+
+#include "postgres.h"
+
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "port/atomics.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+#include "aqo_shared.h"
+#include "counters.h"
+
+
+typedef struct CountersEntry
+{
+	uint64		queryid;		/* hash key, must be the first */
+
+	slock_t		mutex;			/* protects the counters below */
+	int64		calls[AQO_HOOK_COUNT];
+	double		time[AQO_HOOK_COUNT];	/* in milliseconds */
+	PredictionCounters pred;
+} CountersEntry;
+
+typedef struct LockCounters
+{
+	pg_atomic_uint64	acquisitions;
+	pg_atomic_uint64	contended;	/* acquisitions, which had to wait */
+	pg_atomic_uint64	wait_time;	/* in microseconds */
+} LockCounters;
+
+/* Keep counters of different locks in different cache lines */
+typedef union LockCountersPadded
+{
+	LockCounters	counters;
+	char			pad[PG_CACHE_LINE_SIZE];
+} LockCountersPadded;
+
+typedef struct DsaCounters
+{
+	pg_atomic_uint64	allocs;
+	pg_atomic_uint64	frees;
+	pg_atomic_uint64	alloc_bytes;
+	pg_atomic_uint64	free_bytes;
+} DsaCounters;
+
+/* PredictionCounters of all query classes, updated without locks */
+typedef struct TotalCounters
+{
+	pg_atomic_uint64	predictions[AQO_PRED_COUNT];
+	pg_atomic_uint64	wide_scans;
+	pg_atomic_uint64	wide_scanned;
+	pg_atomic_uint64	collisions;
+} TotalCounters;
+
+typedef struct CountersState
+{
+	LWLock		lock;			/* protects the hash table structure */
+
+	TotalCounters		total;
+
+	LockCountersPadded	locks[AQO_LOCK_COUNT];
+	DsaCounters			dsa[AQO_DSA_COUNT];
+} CountersState;
+
+typedef enum {
+	OH_QUERYID = 0, OH_HOOK, OH_CALLS, OH_TOTAL_TIME, OH_MEAN_TIME,
+	OH_TOTAL_NCOLS
+} aqo_overhead_cols;
+
+typedef enum {
+	PS_EXACT = 0, PS_WIDE, PS_FEW_NEIGHBORS, PS_MISSES, PS_HIT_RATE,
+	PS_WIDE_SCANS, PS_WIDE_SCAN_LENGTH, PS_COLLISIONS, PS_TOTAL_NCOLS
+} aqo_prediction_cols;
+
+typedef enum {
+	LS_LOCK = 0, LS_ACQUISITIONS, LS_CONTENDED, LS_WAIT_TIME, LS_TOTAL_NCOLS
+} aqo_lock_stat_cols;
+
+typedef enum {
+	DS_AREA = 0, DS_ALLOCS, DS_FREES, DS_ALLOC_BYTES, DS_FREE_BYTES,
+	DS_USED_BYTES, DS_TOTAL_NCOLS
+} aqo_dsa_stat_cols;
+
+typedef enum {
+	MP_NAME = 0, MP_PEAK_SIZE, MP_TOTAL_NCOLS
+} aqo_memory_peaks_cols;
+
+/* Names of the hooks, shown by the aqo_overhead view */
+static const char *hook_names[AQO_HOOK_COUNT] = {
+	"planner",
+	"baserel_rows",
+	"parameterized_baserel_size",
+	"joinrel_size",
+	"parameterized_joinrel_size",
+	"num_groups",
+	"create_plan",
+	"learn",
+	"executor_end"
+};
+
+/* Names of the locks and DSA areas, shown by aqo_lock_stat and aqo_dsa_stat */
+static const char *lock_names[AQO_LOCK_COUNT] = {
+	"global", "stat", "qtexts", "data", "queries"
+};
+static const char *dsa_names[AQO_DSA_COUNT] = {"qtexts", "data"};
+
+/* Names of the memory contexts, as they are created in _PG_init */
+static const char *memctx_names[AQO_MEMCTX_COUNT] = {
+	"AQOPredictMemoryContext", "AQOLearnMemoryContext", "AQOCacheMemCtx"
+};
+
+bool aqo_track_overhead = false;
+
+static CountersState *counters_state = NULL;
+static HTAB *counters_htab = NULL;
+
+/* Counters of the backend, not flushed into the shared table yet */
+static AqoLocalCounters local;
+
+/* Peak sizes of the backend memory contexts */
+static Size memctx_peaks[AQO_MEMCTX_COUNT];
+
+PG_FUNCTION_INFO_V1(aqo_overhead);
+PG_FUNCTION_INFO_V1(aqo_overhead_reset);
+PG_FUNCTION_INFO_V1(aqo_prediction_stat);
+PG_FUNCTION_INFO_V1(aqo_prediction_counters);
+PG_FUNCTION_INFO_V1(aqo_prediction_stat_reset);
+PG_FUNCTION_INFO_V1(aqo_lock_stat);
+PG_FUNCTION_INFO_V1(aqo_lock_stat_reset);
+PG_FUNCTION_INFO_V1(aqo_dsa_stat);
+PG_FUNCTION_INFO_V1(aqo_memory_peaks);
+PG_FUNCTION_INFO_V1(aqo_memory_peaks_reset);
+
+
+Size
+counters_memsize(void)
+{
+	return add_size(MAXALIGN(sizeof(CountersState)),
+					hash_estimate_size(fs_max_items, sizeof(CountersEntry)));
+}
+
+/*
+ * Must be called under the AddinShmemInitLock.
+ */
+void
+counters_init_shmem(void)
+{
+	bool		found;
+	HASHCTL		info;
+
+	counters_state = ShmemInitStruct("AQO Counters", sizeof(CountersState),
+									 &found);
+	if (!found)
+	{
+		int		i;
+
+		LWLockInitialize(&counters_state->lock, LWLockNewTrancheId());
+		for (i = 0; i < AQO_PRED_COUNT; i++)
+			pg_atomic_init_u64(&counters_state->total.predictions[i], 0);
+		pg_atomic_init_u64(&counters_state->total.wide_scans, 0);
+		pg_atomic_init_u64(&counters_state->total.wide_scanned, 0);
+		pg_atomic_init_u64(&counters_state->total.collisions, 0);
+
+		for (i = 0; i < AQO_LOCK_COUNT; i++)
+		{
+			LockCounters *lc = &counters_state->locks[i].counters;
+
+			pg_atomic_init_u64(&lc->acquisitions, 0);
+			pg_atomic_init_u64(&lc->contended, 0);
+			pg_atomic_init_u64(&lc->wait_time, 0);
+		}
+
+		for (i = 0; i < AQO_DSA_COUNT; i++)
+		{
+			pg_atomic_init_u64(&counters_state->dsa[i].allocs, 0);
+			pg_atomic_init_u64(&counters_state->dsa[i].frees, 0);
+			pg_atomic_init_u64(&counters_state->dsa[i].alloc_bytes, 0);
+			pg_atomic_init_u64(&counters_state->dsa[i].free_bytes, 0);
+		}
+	}
+
+	info.keysize = sizeof(((CountersEntry *) 0)->queryid);
+	info.entrysize = sizeof(CountersEntry);
+	counters_htab = ShmemInitHash("AQO Counters HTAB", fs_max_items,
+								  fs_max_items, &info, HASH_ELEM | HASH_BLOBS);
+
+	LWLockRegisterTranche(counters_state->lock.tranche,
+						  "AQO Counters Lock Tranche");
+}
+
+void
+aqo_overhead_add(AqoHook hook, instr_time elapsed, bool new_call)
+{
+	Assert(hook >= 0 && hook < AQO_HOOK_COUNT);
+
+	if (new_call)
+		local.calls[hook]++;
+	INSTR_TIME_ADD(local.time[hook], elapsed);
+	local.changed = true;
+}
+
+void
+aqo_prediction_count(AqoPredictionSource source)
+{
+	Assert(source >= 0 && source < AQO_PRED_COUNT);
+
+	local.pred.predictions[source]++;
+	local.changed = true;
+}
+
+void
+aqo_wide_search_count(int64 nscanned)
+{
+	local.pred.wide_scans++;
+	local.pred.wide_scanned += nscanned;
+	local.changed = true;
+}
+
+/*
+ * Collisions are detected by learning too, which may be made by a background
+ * worker without any query class. So, add them to the total counter at once.
+ */
+void
+aqo_collision_count(void)
+{
+	local.pred.collisions++;
+	local.changed = true;
+
+	if (counters_state == NULL)
+		return;
+
+	pg_atomic_fetch_add_u64(&counters_state->total.collisions, 1);
+}
+
+static LockCounters *
+get_lock_counters(LWLock *lock)
+{
+	AqoLock		id;
+
+	if (counters_state == NULL || aqo_state == NULL)
+		return NULL;
+
+	if (lock == &aqo_state->lock)
+		id = AQO_LOCK_GLOBAL;
+	else if (lock == &aqo_state->stat_lock)
+		id = AQO_LOCK_STAT;
+	else if (lock == &aqo_state->qtexts_lock)
+		id = AQO_LOCK_QTEXTS;
+	else if (lock == &aqo_state->data_lock)
+		id = AQO_LOCK_DATA;
+	else if (lock == &aqo_state->queries_lock)
+		id = AQO_LOCK_QUERIES;
+	else
+		return NULL;
+
+	return &counters_state->locks[id].counters;
+}
+
+/*
+ * LWLockAcquire() for the locks of the AQO shared state. At first, try to take
+ * the lock without waiting, so the clock is read in the contended case only.
+ */
+void
+aqo_lwlock_acquire(LWLock *lock, LWLockMode mode)
+{
+	LockCounters   *lc = get_lock_counters(lock);
+	instr_time		start;
+	instr_time		now;
+
+	if (lc == NULL)
+	{
+		LWLockAcquire(lock, mode);
+		return;
+	}
+
+	pg_atomic_fetch_add_u64(&lc->acquisitions, 1);
+	if (LWLockConditionalAcquire(lock, mode))
+		return;
+
+	INSTR_TIME_SET_CURRENT(start);
+	LWLockAcquire(lock, mode);
+	INSTR_TIME_SET_CURRENT(now);
+	INSTR_TIME_SUBTRACT(now, start);
+
+	pg_atomic_fetch_add_u64(&lc->contended, 1);
+	pg_atomic_fetch_add_u64(&lc->wait_time, INSTR_TIME_GET_MICROSEC(now));
+}
+
+void
+aqo_dsa_count(AqoDsaArea area, Size size, bool alloc)
+{
+	DsaCounters *dc;
+
+	Assert(area >= 0 && area < AQO_DSA_COUNT);
+
+	if (counters_state == NULL)
+		return;
+
+	dc = &counters_state->dsa[area];
+	if (alloc)
+	{
+		pg_atomic_fetch_add_u64(&dc->allocs, 1);
+		pg_atomic_fetch_add_u64(&dc->alloc_bytes, size);
+	}
+	else
+	{
+		pg_atomic_fetch_add_u64(&dc->frees, 1);
+		pg_atomic_fetch_add_u64(&dc->free_bytes, size);
+	}
+}
+
+void
+aqo_memory_peak_update(AqoMemCtx id, MemoryContext ctx)
+{
+	Size		size;
+
+	Assert(id >= 0 && id < AQO_MEMCTX_COUNT);
+
+	size = MemoryContextMemAllocated(ctx, true);
+	if (size > memctx_peaks[id])
+		memctx_peaks[id] = size;
+}
+
+static void
+add_prediction_counters(PredictionCounters *dst, PredictionCounters *src)
+{
+	int			i;
+
+	for (i = 0; i < AQO_PRED_COUNT; i++)
+		dst->predictions[i] += src->predictions[i];
+	dst->wide_scans += src->wide_scans;
+	dst->wide_scanned += src->wide_scanned;
+	dst->collisions += src->collisions;
+}
+
+static inline void
+total_counter_add(pg_atomic_uint64 *counter, int64 value)
+{
+	if (value != 0)
+		pg_atomic_fetch_add_u64(counter, value);
+}
+
+static bool
+prediction_counters_empty(PredictionCounters *pred)
+{
+	int			i;
+
+	for (i = 0; i < AQO_PRED_COUNT; i++)
+		if (pred->predictions[i] != 0)
+			return false;
+
+	return pred->wide_scans == 0 && pred->collisions == 0;
+}
+
+static bool
+overhead_counters_empty(CountersEntry *entry)
+{
+	int			i;
+
+	for (i = 0; i < AQO_HOOK_COUNT; i++)
+		if (entry->calls[i] != 0 || entry->time[i] != 0.)
+			return false;
+
+	return true;
+}
+
+/*
+ * Add the local prediction counters to the total ones and, with
+ * aqo.track_overhead, all the local counters to the counters of the query
+ * class. Collisions are already in the total counters.
+ */
+static void
+counters_flush(uint64 queryid)
+{
+	CountersEntry  *entry;
+	bool			found;
+	int				i;
+
+	for (i = 0; i < AQO_PRED_COUNT; i++)
+		total_counter_add(&counters_state->total.predictions[i],
+						  local.pred.predictions[i]);
+	total_counter_add(&counters_state->total.wide_scans, local.pred.wide_scans);
+	total_counter_add(&counters_state->total.wide_scanned,
+					  local.pred.wide_scanned);
+
+	if (!aqo_track_overhead)
+		return;
+
+	LWLockAcquire(&counters_state->lock, LW_SHARED);
+	entry = (CountersEntry *) hash_search(counters_htab, &queryid, HASH_FIND,
+										  NULL);
+	if (entry == NULL)
+	{
+		/* Need exclusive lock to add a new entry */
+		LWLockRelease(&counters_state->lock);
+		LWLockAcquire(&counters_state->lock, LW_EXCLUSIVE);
+
+		entry = (CountersEntry *) hash_search(counters_htab, &queryid,
+											  HASH_ENTER_NULL, &found);
+		if (entry == NULL)
+		{
+			/* The table is full, lose the counters of the class */
+			LWLockRelease(&counters_state->lock);
+			return;
+		}
+
+		if (!found)
+		{
+			SpinLockInit(&entry->mutex);
+			memset(entry->calls, 0, sizeof(entry->calls));
+			memset(entry->time, 0, sizeof(entry->time));
+			memset(&entry->pred, 0, sizeof(entry->pred));
+		}
+	}
+
+	SpinLockAcquire(&entry->mutex);
+	for (i = 0; i < AQO_HOOK_COUNT; i++)
+	{
+		entry->calls[i] += local.calls[i];
+		entry->time[i] += INSTR_TIME_GET_MILLISEC(local.time[i]);
+	}
+	add_prediction_counters(&entry->pred, &local.pred);
+	SpinLockRelease(&entry->mutex);
+	LWLockRelease(&counters_state->lock);
+}
+
+/*
+ * Start counting for a planning or an execution stage of a query, which can
+ * be nested into a stage of another one. Counters of the outer stage are moved
+ * into the *saved.
+ */
+void
+aqo_counters_save(AqoLocalCounters *saved)
+{
+	memcpy(saved, &local, sizeof(AqoLocalCounters));
+	aqo_counters_discard();
+}
+
+/*
+ * Finish the stage, started by the aqo_counters_save(): flush its counters into
+ * the query class and restore counters of the outer stage. Counters of a query,
+ * not processed by AQO (zero queryid), are lost.
+ */
+void
+aqo_counters_restore(AqoLocalCounters *saved, uint64 queryid)
+{
+	if (local.changed && queryid != 0 && counters_htab != NULL)
+		counters_flush(queryid);
+
+	memcpy(&local, saved, sizeof(AqoLocalCounters));
+}
+
+/*
+ * Forget the local counters. Called at the start of a stage and at the abort
+ * of a transaction, which interrupted a stage.
+ */
+void
+aqo_counters_discard(void)
+{
+	memset(&local, 0, sizeof(AqoLocalCounters));
+}
+
+/*
+ * Remove counters of the query class.
+ */
+void
+aqo_counters_remove(uint64 queryid)
+{
+	if (counters_htab == NULL)
+		return;
+
+	LWLockAcquire(&counters_state->lock, LW_EXCLUSIVE);
+	(void) hash_search(counters_htab, &queryid, HASH_REMOVE, NULL);
+	LWLockRelease(&counters_state->lock);
+}
+
+/*
+ * Clear overhead or prediction counters of each query class and remove
+ * entries, which have no counters anymore.
+ * Returns number of classes, which had non-zero counters.
+ */
+static long
+counters_reset_internal(bool overhead, bool prediction)
+{
+	HASH_SEQ_STATUS	hash_seq;
+	CountersEntry  *entry;
+	long			num_reset = 0;
+
+	if (prediction)
+	{
+		int		i;
+
+		for (i = 0; i < AQO_PRED_COUNT; i++)
+			pg_atomic_write_u64(&counters_state->total.predictions[i], 0);
+		pg_atomic_write_u64(&counters_state->total.wide_scans, 0);
+		pg_atomic_write_u64(&counters_state->total.wide_scanned, 0);
+		pg_atomic_write_u64(&counters_state->total.collisions, 0);
+	}
+
+	LWLockAcquire(&counters_state->lock, LW_EXCLUSIVE);
+	hash_seq_init(&hash_seq, counters_htab);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+	{
+		/* Nobody can change counters under the exclusive lock */
+		if ((overhead && !overhead_counters_empty(entry)) ||
+			(prediction && !prediction_counters_empty(&entry->pred)))
+			num_reset++;
+
+		if (overhead)
+		{
+			memset(entry->calls, 0, sizeof(entry->calls));
+			memset(entry->time, 0, sizeof(entry->time));
+		}
+		if (prediction)
+			memset(&entry->pred, 0, sizeof(entry->pred));
+
+		if (overhead_counters_empty(entry) &&
+			prediction_counters_empty(&entry->pred) &&
+			hash_search(counters_htab, &entry->queryid, HASH_REMOVE, NULL) == NULL)
+			elog(ERROR, "[AQO] hash table corrupted");
+	}
+	LWLockRelease(&counters_state->lock);
+
+	return num_reset;
+}
+
+void
+aqo_counters_reset(void)
+{
+	(void) counters_reset_internal(true, true);
+}
+
+/*
+ * Show calls and time of each AQO hook for each query class.
+ */
+Datum
+aqo_overhead(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc			tupDesc;
+	MemoryContext		per_query_ctx;
+	MemoryContext		oldcontext;
+	Tuplestorestate	   *tupstore;
+	Datum				values[OH_TOTAL_NCOLS];
+	bool				nulls[OH_TOTAL_NCOLS];
+	HASH_SEQ_STATUS		hash_seq;
+	CountersEntry	   *entry;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	/* Switch into long-lived context to construct returned data structures */
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	Assert(tupDesc->natts == OH_TOTAL_NCOLS);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	memset(nulls, 0, sizeof(nulls));
+	LWLockAcquire(&counters_state->lock, LW_SHARED);
+	hash_seq_init(&hash_seq, counters_htab);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+	{
+		int64		calls[AQO_HOOK_COUNT];
+		double		time[AQO_HOOK_COUNT];
+		int			i;
+
+		SpinLockAcquire(&entry->mutex);
+		memcpy(calls, entry->calls, sizeof(calls));
+		memcpy(time, entry->time, sizeof(time));
+		SpinLockRelease(&entry->mutex);
+
+		for (i = 0; i < AQO_HOOK_COUNT; i++)
+		{
+			if (calls[i] == 0)
+				continue;
+
+			values[OH_QUERYID] = Int64GetDatum(entry->queryid);
+			values[OH_HOOK] = CStringGetTextDatum(hook_names[i]);
+			values[OH_CALLS] = Int64GetDatum(calls[i]);
+			values[OH_TOTAL_TIME] = Float8GetDatum(time[i]);
+			values[OH_MEAN_TIME] = Float8GetDatum(time[i] / calls[i]);
+			tuplestore_putvalues(tupstore, tupDesc, values, nulls);
+		}
+	}
+
+	LWLockRelease(&counters_state->lock);
+	tuplestore_donestoring(tupstore);
+	return (Datum) 0;
+}
+
+Datum
+aqo_overhead_reset(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_INT64(counters_reset_internal(true, false));
+}
+
+/*
+ * Form values of prediction counters, starting from the values[0].
+ */
+static void
+form_prediction_values(PredictionCounters *pred, Datum *values, bool *nulls)
+{
+	int64		found = pred->predictions[AQO_PRED_EXACT] +
+						pred->predictions[AQO_PRED_WIDE];
+	int64		total = found + pred->predictions[AQO_PRED_FEW_NEIGHBORS] +
+						pred->predictions[AQO_PRED_MISS];
+
+	values[PS_EXACT] = Int64GetDatum(pred->predictions[AQO_PRED_EXACT]);
+	values[PS_WIDE] = Int64GetDatum(pred->predictions[AQO_PRED_WIDE]);
+	values[PS_FEW_NEIGHBORS] =
+		Int64GetDatum(pred->predictions[AQO_PRED_FEW_NEIGHBORS]);
+	values[PS_MISSES] = Int64GetDatum(pred->predictions[AQO_PRED_MISS]);
+
+	nulls[PS_HIT_RATE] = (total == 0);
+	if (total > 0)
+		values[PS_HIT_RATE] = Float8GetDatum((double) found / total);
+
+	values[PS_WIDE_SCANS] = Int64GetDatum(pred->wide_scans);
+	nulls[PS_WIDE_SCAN_LENGTH] = (pred->wide_scans == 0);
+	if (pred->wide_scans > 0)
+		values[PS_WIDE_SCAN_LENGTH] =
+			Float8GetDatum((double) pred->wide_scanned / pred->wide_scans);
+
+	values[PS_COLLISIONS] = Int64GetDatum(pred->collisions);
+}
+
+/*
+ * Show outcomes of cardinality predictions for each query class.
+ */
+Datum
+aqo_prediction_stat(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc			tupDesc;
+	MemoryContext		per_query_ctx;
+	MemoryContext		oldcontext;
+	Tuplestorestate	   *tupstore;
+	Datum				values[PS_TOTAL_NCOLS + 1];
+	bool				nulls[PS_TOTAL_NCOLS + 1];
+	HASH_SEQ_STATUS		hash_seq;
+	CountersEntry	   *entry;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	/* Switch into long-lived context to construct returned data structures */
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	Assert(tupDesc->natts == PS_TOTAL_NCOLS + 1);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	LWLockAcquire(&counters_state->lock, LW_SHARED);
+	hash_seq_init(&hash_seq, counters_htab);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+	{
+		PredictionCounters	pred;
+
+		SpinLockAcquire(&entry->mutex);
+		pred = entry->pred;
+		SpinLockRelease(&entry->mutex);
+
+		if (prediction_counters_empty(&pred))
+			continue;
+
+		/* The first column is the query class */
+		memset(nulls, 0, sizeof(nulls));
+		values[0] = Int64GetDatum(entry->queryid);
+		form_prediction_values(&pred, &values[1], &nulls[1]);
+		tuplestore_putvalues(tupstore, tupDesc, values, nulls);
+	}
+
+	LWLockRelease(&counters_state->lock);
+	tuplestore_donestoring(tupstore);
+	return (Datum) 0;
+}
+
+/*
+ * Return total outcomes of cardinality predictions of all query classes since
+ * the last reset.
+ */
+Datum
+aqo_prediction_counters(PG_FUNCTION_ARGS)
+{
+	TupleDesc			tupDesc;
+	Datum				values[PS_TOTAL_NCOLS];
+	bool				nulls[PS_TOTAL_NCOLS];
+	PredictionCounters	pred;
+	int					i;
+
+	if (get_call_result_type(fcinfo, NULL, &tupDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	Assert(tupDesc->natts == PS_TOTAL_NCOLS);
+
+	for (i = 0; i < AQO_PRED_COUNT; i++)
+		pred.predictions[i] =
+			pg_atomic_read_u64(&counters_state->total.predictions[i]);
+	pred.wide_scans = pg_atomic_read_u64(&counters_state->total.wide_scans);
+	pred.wide_scanned = pg_atomic_read_u64(&counters_state->total.wide_scanned);
+	pred.collisions = pg_atomic_read_u64(&counters_state->total.collisions);
+
+	memset(nulls, 0, sizeof(nulls));
+	form_prediction_values(&pred, values, nulls);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupDesc, values, nulls)));
+}
+
+Datum
+aqo_prediction_stat_reset(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_INT64(counters_reset_internal(false, true));
+}
+
+/*
+ * Show acquisitions of the AQO locks since the start of the instance or the
+ * last aqo_lock_stat_reset().
+ */
+Datum
+aqo_lock_stat(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc			tupDesc;
+	MemoryContext		per_query_ctx;
+	MemoryContext		oldcontext;
+	Tuplestorestate	   *tupstore;
+	Datum				values[LS_TOTAL_NCOLS];
+	bool				nulls[LS_TOTAL_NCOLS];
+	int					i;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	/* Switch into long-lived context to construct returned data structures */
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	Assert(tupDesc->natts == LS_TOTAL_NCOLS);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	memset(nulls, 0, sizeof(nulls));
+	for (i = 0; i < AQO_LOCK_COUNT; i++)
+	{
+		LockCounters *lc = &counters_state->locks[i].counters;
+
+		values[LS_LOCK] = CStringGetTextDatum(lock_names[i]);
+		values[LS_ACQUISITIONS] =
+			Int64GetDatum(pg_atomic_read_u64(&lc->acquisitions));
+		values[LS_CONTENDED] = Int64GetDatum(pg_atomic_read_u64(&lc->contended));
+		values[LS_WAIT_TIME] =
+			Float8GetDatum(pg_atomic_read_u64(&lc->wait_time) / 1000.);
+		tuplestore_putvalues(tupstore, tupDesc, values, nulls);
+	}
+
+	tuplestore_donestoring(tupstore);
+	return (Datum) 0;
+}
+
+Datum
+aqo_lock_stat_reset(PG_FUNCTION_ARGS)
+{
+	int			i;
+	int64		num_reset = 0;
+
+	for (i = 0; i < AQO_LOCK_COUNT; i++)
+	{
+		LockCounters *lc = &counters_state->locks[i].counters;
+
+		/* Contended acquisitions and wait time are counted in acquisitions */
+		if (pg_atomic_exchange_u64(&lc->acquisitions, 0) != 0)
+			num_reset++;
+		pg_atomic_write_u64(&lc->contended, 0);
+		pg_atomic_write_u64(&lc->wait_time, 0);
+	}
+
+	PG_RETURN_INT64(num_reset);
+}
+
+/*
+ * Show allocations in the DSA areas of the storage since the start of the
+ * instance.
+ */
+Datum
+aqo_dsa_stat(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc			tupDesc;
+	MemoryContext		per_query_ctx;
+	MemoryContext		oldcontext;
+	Tuplestorestate	   *tupstore;
+	Datum				values[DS_TOTAL_NCOLS];
+	bool				nulls[DS_TOTAL_NCOLS];
+	int					i;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	/* Switch into long-lived context to construct returned data structures */
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	Assert(tupDesc->natts == DS_TOTAL_NCOLS);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	memset(nulls, 0, sizeof(nulls));
+	for (i = 0; i < AQO_DSA_COUNT; i++)
+	{
+		DsaCounters *dc = &counters_state->dsa[i];
+		uint64		alloc_bytes = pg_atomic_read_u64(&dc->alloc_bytes);
+		uint64		free_bytes = pg_atomic_read_u64(&dc->free_bytes);
+
+		values[DS_AREA] = CStringGetTextDatum(dsa_names[i]);
+		values[DS_ALLOCS] = Int64GetDatum(pg_atomic_read_u64(&dc->allocs));
+		values[DS_FREES] = Int64GetDatum(pg_atomic_read_u64(&dc->frees));
+		values[DS_ALLOC_BYTES] = Int64GetDatum(alloc_bytes);
+		values[DS_FREE_BYTES] = Int64GetDatum(free_bytes);
+		values[DS_USED_BYTES] = Int64GetDatum(alloc_bytes - free_bytes);
+		tuplestore_putvalues(tupstore, tupDesc, values, nulls);
+	}
+
+	tuplestore_donestoring(tupstore);
+	return (Datum) 0;
+}
+
+/*
+ * Show peak sizes of the AQO memory contexts of the backend, seen before their
+ * resets since the start of the backend or the last aqo_memory_peaks_reset().
+ */
+Datum
+aqo_memory_peaks(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc			tupDesc;
+	MemoryContext		per_query_ctx;
+	MemoryContext		oldcontext;
+	Tuplestorestate	   *tupstore;
+	Datum				values[MP_TOTAL_NCOLS];
+	bool				nulls[MP_TOTAL_NCOLS];
+	int					i;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	/* Switch into long-lived context to construct returned data structures */
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	Assert(tupDesc->natts == MP_TOTAL_NCOLS);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupDesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	memset(nulls, 0, sizeof(nulls));
+	for (i = 0; i < AQO_MEMCTX_COUNT; i++)
+	{
+		values[MP_NAME] = CStringGetTextDatum(memctx_names[i]);
+		values[MP_PEAK_SIZE] = Int64GetDatum((int64) memctx_peaks[i]);
+		tuplestore_putvalues(tupstore, tupDesc, values, nulls);
+	}
+
+	tuplestore_donestoring(tupstore);
+	return (Datum) 0;
+}
+
+Datum
+aqo_memory_peaks_reset(PG_FUNCTION_ARGS)
+{
+	int			i;
+	int64		num_reset = 0;
+
+	for (i = 0; i < AQO_MEMCTX_COUNT; i++)
+		if (memctx_peaks[i] != 0)
+			num_reset++;
+
+	memset(memctx_peaks, 0, sizeof(memctx_peaks));
+	PG_RETURN_INT64(num_reset);
+}
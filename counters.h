@@ -0,0 +1,145 @@
+#ifndef AQO_COUNTERS_H
+#define AQO_COUNTERS_H
+
+#include "portability/instr_time.h"
+#include "storage/lwlock.h"
+
+/*
+ * Code paths of AQO, which calls and time are tracked with aqo.track_overhead.
+ * Keep in sync with the hook_names in counters.c.
+ */
+typedef enum AqoHook
+{
+	AQO_HOOK_PLANNER = 0,
+	AQO_HOOK_BASEREL_ROWS,
+	AQO_HOOK_PARAM_BASEREL_SIZE,
+	AQO_HOOK_JOINREL_SIZE,
+	AQO_HOOK_PARAM_JOINREL_SIZE,
+	AQO_HOOK_NUM_GROUPS,
+	AQO_HOOK_CREATE_PLAN,
+	AQO_HOOK_LEARN,
+	AQO_HOOK_EXECUTOR_END,
+
+	AQO_HOOK_COUNT
+} AqoHook;
+
+/* Outcomes of a cardinality prediction, shown by the aqo_prediction_stat */
+typedef enum AqoPredictionSource
+{
+	AQO_PRED_EXACT = 0,			/* found in the feature space of the query */
+	AQO_PRED_WIDE,				/* found in neighbour feature spaces */
+	AQO_PRED_FEW_NEIGHBORS,		/* found, but too few neighbours to predict */
+	AQO_PRED_MISS,				/* nothing found */
+
+	AQO_PRED_COUNT
+} AqoPredictionSource;
+
+typedef struct PredictionCounters
+{
+	int64		predictions[AQO_PRED_COUNT];
+	int64		wide_scans;		/* number of the wide searches */
+	int64		wide_scanned;	/* entries, looked through by the wide searches */
+	int64		collisions;
+} PredictionCounters;
+
+/*
+ * Counters of a planning or an execution stage of a query in the backend,
+ * flushed into its query class at the end of the stage.
+ */
+typedef struct AqoLocalCounters
+{
+	int64		calls[AQO_HOOK_COUNT];
+	instr_time	time[AQO_HOOK_COUNT];
+	PredictionCounters pred;
+	bool		changed;
+} AqoLocalCounters;
+
+/* Locks of the AQO shared state, shown by the aqo_lock_stat */
+typedef enum AqoLock
+{
+	AQO_LOCK_GLOBAL = 0,
+	AQO_LOCK_STAT,
+	AQO_LOCK_QTEXTS,
+	AQO_LOCK_DATA,
+	AQO_LOCK_QUERIES,
+
+	AQO_LOCK_COUNT
+} AqoLock;
+
+/* DSA areas of the AQO storage, shown by the aqo_dsa_stat */
+typedef enum AqoDsaArea
+{
+	AQO_DSA_QTEXTS = 0,
+	AQO_DSA_DATA,
+
+	AQO_DSA_COUNT
+} AqoDsaArea;
+
+/*
+ * Memory contexts of the backend, which peak sizes are tracked with
+ * aqo.track_overhead. Keep in sync with the memctx_names in counters.c.
+ */
+typedef enum AqoMemCtx
+{
+	AQO_MEMCTX_PREDICT = 0,
+	AQO_MEMCTX_LEARN,
+	AQO_MEMCTX_CACHE,
+
+	AQO_MEMCTX_COUNT
+} AqoMemCtx;
+
+extern bool aqo_track_overhead;
+
+extern Size counters_memsize(void);
+extern void counters_init_shmem(void);
+
+extern void aqo_overhead_add(AqoHook hook, instr_time elapsed, bool new_call);
+extern void aqo_prediction_count(AqoPredictionSource source);
+extern void aqo_wide_search_count(int64 nscanned);
+extern void aqo_collision_count(void);
+extern void aqo_counters_save(AqoLocalCounters *saved);
+extern void aqo_counters_restore(AqoLocalCounters *saved, uint64 queryid);
+extern void aqo_counters_discard(void);
+extern void aqo_counters_remove(uint64 queryid);
+extern void aqo_counters_reset(void);
+extern void aqo_lwlock_acquire(LWLock *lock, LWLockMode mode);
+extern void aqo_dsa_count(AqoDsaArea area, Size size, bool alloc);
+extern void aqo_memory_peak_update(AqoMemCtx id, MemoryContext ctx);
+
+static inline void
+aqo_overhead_start(instr_time *start)
+{
+	if (aqo_track_overhead)
+		INSTR_TIME_SET_CURRENT(*start);
+	else
+		INSTR_TIME_SET_ZERO(*start);
+}
+
+/*
+ * Account time of the hook, spent since the *start. A hook, which code is
+ * split by a call of the core routine, passes new_call = false for the tail.
+ */
+static inline void
+aqo_overhead_stop(AqoHook hook, instr_time *start, bool new_call)
+{
+	instr_time	now;
+
+	if (INSTR_TIME_IS_ZERO(*start))
+		return;
+
+	INSTR_TIME_SET_CURRENT(now);
+	INSTR_TIME_SUBTRACT(now, *start);
+	aqo_overhead_add(hook, now, new_call);
+}
+
+/*
+ * Remember size of the context before its reset.
+ */
+static inline void
+aqo_memory_peak(AqoMemCtx id, MemoryContext ctx)
+{
+	if (aqo_track_overhead)
+		aqo_memory_peak_update(id, ctx);
+}
+
+#endif							/* AQO_COUNTERS_H */
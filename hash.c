@@ -135,13 +135,18 @@ ldelete_uint64(List *list, uint64 datum)
 
 /********************************************************************************/
 
+/*
+ * Computes order-insensitive hash of a list of grouping expressions.
+ * It doesn't depend on the underlying plan and can be computed once at the
+ * planning stage.
+ */
 int
-get_grouped_exprs_hash(int child_fss, List *group_exprs)
+get_grouping_exprs_hash(List *group_exprs)
 {
 	ListCell	*lc;
 	int			*hashes = palloc(list_length(group_exprs) * sizeof(int));
 	int			i = 0;
-	int			final_hashes[2];
+	int			result;
 
 	/* Calculate hash of each grouping expression. */
 	foreach(lc, group_exprs)
@@ -154,8 +159,18 @@ get_grouped_exprs_hash(int child_fss, List *group_exprs)
 	/* Sort to get rid of expressions permutation. */
 	qsort(hashes, i, sizeof(int), int_cmp);
 
+	result = get_int_array_hash(hashes, i);
+	pfree(hashes);
+	return result;
+}
+
+int
+get_grouped_exprs_hash(int child_fss, int grouping_exprs_hash)
+{
+	int			final_hashes[2];
+
 	final_hashes[0] = child_fss;
-	final_hashes[1] = get_int_array_hash(hashes, i);
+	final_hashes[1] = grouping_exprs_hash;
 
 	return get_int_array_hash(final_hashes, 2);
 }
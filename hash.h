@@ -11,6 +11,7 @@ extern int get_fss_for_object(List *relsigns, List *clauselist,
 							  List *selectivities, int *nfeatures,
 							  double **features);
 extern int get_int_array_hash(int *arr, int len);
-extern int get_grouped_exprs_hash(int fss, List *group_exprs);
+extern int get_grouping_exprs_hash(List *group_exprs);
+extern int get_grouped_exprs_hash(int fss, int grouping_exprs_hash);
 
 #endif							/* AQO_HASH_H */
\ No newline at end of file
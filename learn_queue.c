@@ -0,0 +1,355 @@
+/*
+ *******************************************************************************
+ *
+ *	ASYNCHRONOUS LEARNING QUEUE
+ *
+ * At the end of execution a backend only captures compact learning samples
+ * (fs, fss, features, target, rfactor, reloids) into a ring buffer in shared
+ * memory. Background workers apply them to the knowledge base in chunks,
+ * grouped by feature subspace, so the query doesn't wait for the locked
+ * load-learn-store step. If the queue is full, the
+ * sample is too big for a slot or no worker is running, the backend learns
+ * synchronously, as before.
+ *
+ *******************************************************************************
+ *
+ * Copyright (c) 2016-2022, Postgres Professional
+ *
+ * IDENTIFICATION
+ *	  aqo/learn_queue.c
+ *
+ */
+
+#include "postgres.h"
+
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/interrupt.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+
+#include "aqo.h"
+#include "learn_queue.h"
+#include "storage.h"
+
+
+/* Compact learning sample */
+typedef struct LearnSample
+{
+	uint64	fs;
+	int		fss;
+	int		ncols;
+	int		nrels;
+	double	target;
+	double	rfactor;
+	double	features[AQO_LEARN_QUEUE_MAX_FEATURES];
+	Oid		reloids[AQO_LEARN_QUEUE_MAX_RELS];
+} LearnSample;
+
+typedef struct LearnQueue
+{
+	LWLock		lock;		/* protects all the fields below */
+
+	uint64		head;		/* next slot to write */
+	uint64		tail;		/* next slot to read */
+	int			nslots;
+
+	/* Latches of the running workers, NULL if the worker isn't running */
+	Latch	   *latches[AQO_LEARN_WORKERS_MAX];
+
+	LearnSample	samples[FLEXIBLE_ARRAY_MEMBER];
+} LearnQueue;
+
+int aqo_learn_workers = 0;
+int aqo_learn_queue_size = 1024;
+
+static LearnQueue *learn_queue = NULL;
+
+/*
+ * Maximum number of samples, which a worker pops from the queue and learns on
+ * at once.
+ */
+#define AQO_LEARN_QUEUE_CHUNK	(64)
+
+/* Number of samples, pushed since the queue was locked by the backend */
+static int pushed_samples = 0;
+
+PGDLLEXPORT void aqo_learn_worker_main(Datum main_arg);
+
+
+Size
+learn_queue_memsize(void)
+{
+	if (aqo_learn_workers <= 0)
+		return 0;
+
+	return add_size(offsetof(LearnQueue, samples),
+					mul_size(aqo_learn_queue_size, sizeof(LearnSample)));
+}
+
+/*
+ * Must be called under the AddinShmemInitLock.
+ */
+void
+learn_queue_init_shmem(void)
+{
+	bool	found;
+
+	learn_queue = NULL;
+
+	if (aqo_learn_workers <= 0)
+		return;
+
+	learn_queue = ShmemInitStruct("AQO Learn Queue", learn_queue_memsize(),
+								  &found);
+	if (!found)
+	{
+		LWLockInitialize(&learn_queue->lock, LWLockNewTrancheId());
+		learn_queue->head = 0;
+		learn_queue->tail = 0;
+		learn_queue->nslots = aqo_learn_queue_size;
+		memset(learn_queue->latches, 0, sizeof(learn_queue->latches));
+	}
+
+	LWLockRegisterTranche(learn_queue->lock.tranche,
+						  "AQO Learn Queue Lock Tranche");
+}
+
+/*
+ * Register static learning workers. Should be called from the _PG_init().
+ */
+void
+learn_queue_register_workers(void)
+{
+	BackgroundWorker	worker;
+	int					i;
+
+	for (i = 0; i < aqo_learn_workers; i++)
+	{
+		MemSet(&worker, 0, sizeof(worker));
+
+		worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+		worker.bgw_start_time = BgWorkerStart_ConsistentState;
+		worker.bgw_restart_time = 10;
+		worker.bgw_main_arg = Int32GetDatum(i);
+		snprintf(worker.bgw_function_name, BGW_MAXLEN, "aqo_learn_worker_main");
+		snprintf(worker.bgw_library_name, BGW_MAXLEN, "aqo");
+		snprintf(worker.bgw_name, BGW_MAXLEN, "aqo learner %d", i);
+		snprintf(worker.bgw_type, BGW_MAXLEN, "aqo learner");
+
+		RegisterBackgroundWorker(&worker);
+	}
+}
+
+/*
+ * Lock the queue to push a batch of learning samples into it.
+ *
+ * Returns false if the queue can't accept samples at all and the caller must
+ * learn synchronously. Otherwise, the caller pushes the samples with
+ * learn_queue_push() and calls learn_queue_unlock() at once: the lock is
+ * held exclusively, so don't do anything expensive in between.
+ */
+bool
+learn_queue_lock(void)
+{
+	int		i;
+
+	if (learn_queue == NULL)
+		return false;
+
+	LWLockAcquire(&learn_queue->lock, LW_EXCLUSIVE);
+
+	for (i = 0; i < AQO_LEARN_WORKERS_MAX; i++)
+	{
+		if (learn_queue->latches[i] != NULL)
+		{
+			pushed_samples = 0;
+			return true;
+		}
+	}
+
+	LWLockRelease(&learn_queue->lock);
+	return false;
+}
+
+/*
+ * Put the learning sample into the queue, locked by the learn_queue_lock().
+ *
+ * Returns false if the sample wasn't queued and the caller must learn it
+ * synchronously.
+ */
+bool
+learn_queue_push(uint64 fs, int fss, int ncols, double *features,
+				 double target, double rfactor, List *reloids)
+{
+	LearnSample	   *sample;
+	ListCell	   *lc;
+
+	Assert(LWLockHeldByMeInMode(&learn_queue->lock, LW_EXCLUSIVE));
+
+	if (ncols > AQO_LEARN_QUEUE_MAX_FEATURES ||
+		list_length(reloids) > AQO_LEARN_QUEUE_MAX_RELS ||
+		learn_queue->head - learn_queue->tail >= learn_queue->nslots)
+		return false;
+
+	sample = &learn_queue->samples[learn_queue->head % learn_queue->nslots];
+	sample->fs = fs;
+	sample->fss = fss;
+	sample->ncols = ncols;
+	sample->target = target;
+	sample->rfactor = rfactor;
+	if (ncols > 0)
+		memcpy(sample->features, features, sizeof(double) * ncols);
+
+	sample->nrels = 0;
+	foreach(lc, reloids)
+		sample->reloids[sample->nrels++] = lfirst_oid(lc);
+
+	learn_queue->head++;
+	pushed_samples++;
+	return true;
+}
+
+/*
+ * Unlock the queue and wake up the workers, if something was pushed.
+ */
+void
+learn_queue_unlock(void)
+{
+	int		i;
+
+	Assert(LWLockHeldByMeInMode(&learn_queue->lock, LW_EXCLUSIVE));
+
+	for (i = 0; pushed_samples > 0 && i < AQO_LEARN_WORKERS_MAX; i++)
+	{
+		if (learn_queue->latches[i] != NULL)
+			SetLatch(learn_queue->latches[i]);
+	}
+
+	LWLockRelease(&learn_queue->lock);
+}
+
+/*
+ * Copy up to 'nsamples' oldest samples out of the queue under one lock.
+ * Returns the number of copied samples, zero if the queue is empty.
+ */
+static int
+learn_queue_pop(LearnSample *samples, int nsamples)
+{
+	int		n = 0;
+
+	LWLockAcquire(&learn_queue->lock, LW_EXCLUSIVE);
+
+	while (n < nsamples && learn_queue->head != learn_queue->tail)
+	{
+		LearnSample	   *slot;
+		LearnSample	   *sample = &samples[n++];
+
+		slot = &learn_queue->samples[learn_queue->tail % learn_queue->nslots];
+		memcpy(sample, slot, offsetof(LearnSample, features));
+		memcpy(sample->features, slot->features, sizeof(double) * slot->ncols);
+		memcpy(sample->reloids, slot->reloids, sizeof(Oid) * slot->nrels);
+		learn_queue->tail++;
+	}
+
+	LWLockRelease(&learn_queue->lock);
+	return n;
+}
+
+/*
+ * Learn on the popped samples. As a backend does, group them by feature
+ * subspace, so each of them is loaded and stored once per chunk.
+ */
+static void
+learn_queue_apply(LearnSample *samples, int nsamples)
+{
+	int		i;
+
+	learn_batch_begin();
+
+	for (i = 0; i < nsamples; i++)
+	{
+		LearnSample	   *sample = &samples[i];
+		List		   *reloids = NIL;
+		int				j;
+
+		for (j = 0; j < sample->nrels; j++)
+			reloids = lappend_oid(reloids, sample->reloids[j]);
+
+		learn_batch_add(sample->fs, sample->fss, sample->ncols,
+						sample->features, sample->target, sample->rfactor,
+						reloids);
+	}
+
+	learn_batch_apply(true);
+}
+
+static void
+learn_worker_detach(int code, Datum arg)
+{
+	int	slot = DatumGetInt32(arg);
+
+	LWLockAcquire(&learn_queue->lock, LW_EXCLUSIVE);
+	learn_queue->latches[slot] = NULL;
+	LWLockRelease(&learn_queue->lock);
+}
+
+/*
+ * Entry point for the learning worker's process.
+ */
+void
+aqo_learn_worker_main(Datum main_arg)
+{
+	int				slot = DatumGetInt32(main_arg);
+	LearnSample	   *samples;
+	int				nsamples;
+
+	pqsignal(SIGHUP, SignalHandlerForConfigReload);
+	pqsignal(SIGTERM, SignalHandlerForShutdownRequest);
+	BackgroundWorkerUnblockSignals();
+
+	Assert(learn_queue != NULL && slot >= 0 && slot < AQO_LEARN_WORKERS_MAX);
+
+	samples = MemoryContextAlloc(AQOTopMemCtx,
+								 sizeof(LearnSample) * AQO_LEARN_QUEUE_CHUNK);
+
+	LWLockAcquire(&learn_queue->lock, LW_EXCLUSIVE);
+	learn_queue->latches[slot] = MyLatch;
+	LWLockRelease(&learn_queue->lock);
+	before_shmem_exit(learn_worker_detach, Int32GetDatum(slot));
+
+	for (;;)
+	{
+		ResetLatch(MyLatch);
+
+		if (ConfigReloadPending)
+		{
+			ConfigReloadPending = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		/* Drain the queue. Samples queued before the shutdown are applied too. */
+		while ((nsamples = learn_queue_pop(samples,
+										   AQO_LEARN_QUEUE_CHUNK)) > 0)
+		{
+			MemoryContext	old_ctx = MemoryContextSwitchTo(AQOLearnMemCtx);
+
+			learn_queue_apply(samples, nsamples);
+			MemoryContextSwitchTo(old_ctx);
+			MemoryContextReset(AQOLearnMemCtx);
+		}
+
+		if (ShutdownRequestPending)
+			break;
+
+		(void) WaitLatch(MyLatch, WL_LATCH_SET | WL_EXIT_ON_PM_DEATH, -1L,
+						 PG_WAIT_EXTENSION);
+	}
+
+	proc_exit(0);
+}
@@ -0,0 +1,26 @@
+#ifndef AQO_LEARN_QUEUE_H
+#define AQO_LEARN_QUEUE_H
+
+#include "nodes/pg_list.h"
+
+/*
+ * Limits of a sample which can be passed through the learning queue. Bigger
+ * samples are learned synchronously by the backend.
+ */
+#define AQO_LEARN_QUEUE_MAX_FEATURES	(64)
+#define AQO_LEARN_QUEUE_MAX_RELS		(32)
+
+#define AQO_LEARN_WORKERS_MAX			(8)
+
+extern int aqo_learn_workers;
+extern int aqo_learn_queue_size;
+
+extern Size learn_queue_memsize(void);
+extern void learn_queue_init_shmem(void);
+extern void learn_queue_register_workers(void);
+extern bool learn_queue_lock(void);
+extern bool learn_queue_push(uint64 fs, int fss, int ncols, double *features,
+							 double target, double rfactor, List *reloids);
+extern void learn_queue_unlock(void);
+
+#endif							/* AQO_LEARN_QUEUE_H */
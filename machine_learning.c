@@ -21,7 +21,8 @@
 
 #include "postgres.h"
 
-#include "aqo.h"
+#include <math.h>
+
 #include "machine_learning.h"
 
 
@@ -170,6 +171,27 @@ OkNNr_predict(OkNNrdata *data, double *features)
 	return result;
 }
 
+/*
+ * Returns distance from the features to the nearest object of the matrix or -1,
+ * if the matrix is empty.
+ */
+double
+OkNNr_nearest_distance(OkNNrdata *data, double *features)
+{
+	double	result = -1.;
+	int		i;
+
+	for (i = 0; i < data->rows; ++i)
+	{
+		double	distance = fs_distance(data->matrix[i], features, data->cols);
+
+		if (result < 0. || distance < result)
+			result = distance;
+	}
+
+	return result;
+}
+
 /*
  * Modifies given matrix and targets using features and target value of new
  * object.
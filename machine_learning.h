@@ -7,6 +7,10 @@
 extern const double object_selection_threshold;
 extern const double learning_rate;
 
+/* The number of nearest neighbors which will be chosen for ML-operations */
+extern int	aqo_k;
+extern bool aqo_predict_with_few_neighbors;
+
 #define RELIABILITY_MIN		(0.1)
 #define RELIABILITY_MAX		(1.0)
 
@@ -42,6 +46,7 @@ extern void OkNNr_free(OkNNrdata *data);
 
 /* Machine learning techniques */
 extern double OkNNr_predict(OkNNrdata *data, double *features);
+extern double OkNNr_nearest_distance(OkNNrdata *data, double *features);
 extern int OkNNr_learn(OkNNrdata *data,
 					   double *features, double target, double rfactor);
 
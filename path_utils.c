@@ -21,6 +21,7 @@
 #include "utils/lsyscache.h"
 
 #include "aqo.h"
+#include "counters.h"
 #include "hash.h"
 
 #include "postgres_fdw.h"
@@ -41,14 +42,38 @@ static AQOPlanNode DefaultAQOPlanNode =
 	.rels = NULL,
 	.clauses = NIL,
 	.selectivities = NIL,
-	.grouping_exprs = NIL,
+	.ngrouping_exprs = 0,
+	.grouping_exprs_hash = 0,
 	.jointype = -1,
 	.parallel_divisor = -1.,
 	.was_parametrized = false,
+	.learn_fss = 0,
+	.nfeatures = -1,
+	.features = NULL,
 	.fss = INT_MAX,
-	.prediction = -1
+	.prediction = -1,
+	.source = AQO_SOURCE_NONE,
+	.model_rows = 0,
+	.nn_distance = -1.,
+	.predict_time = -1.
 };
 
+/*
+ * Details of the predictions, made during the planning, by fss. Used to fill
+ * provenance of the predictions in the plan nodes.
+ */
+typedef struct PredictionDetails
+{
+	int					fss;	/* hash key */
+	AqoEstimationSource	source;
+	int					model_rows;
+	double				nn_distance;
+	double				predict_time;
+} PredictionDetails;
+
+static HTAB *prediction_details = NULL;
+static MemoryContext AQOPredictDetailsMemCtx = NULL;
+
 static AQOPlanNode *
 create_aqo_plan_node()
 {
@@ -63,6 +88,84 @@ create_aqo_plan_node()
 }
 
 
+/*
+ * Remember how the prediction for the fss was made. The start is the time,
+ * when the prediction was started.
+ */
+void
+prediction_details_store(int fss, AqoEstimationSource source, int model_rows,
+						 double nn_distance, instr_time *start)
+{
+	PredictionDetails  *entry;
+	instr_time			now;
+
+	if (!aqo_show_provenance)
+		return;
+
+	if (AQOPredictDetailsMemCtx == NULL)
+		AQOPredictDetailsMemCtx = AllocSetContextCreate(AQOTopMemCtx,
+													"AQOPredictDetailsMemCtx",
+													ALLOCSET_DEFAULT_SIZES);
+
+	if (prediction_details == NULL)
+	{
+		HASHCTL		hash_ctl;
+
+		MemSet(&hash_ctl, 0, sizeof(hash_ctl));
+		hash_ctl.keysize = sizeof(int);
+		hash_ctl.entrysize = sizeof(PredictionDetails);
+		hash_ctl.hcxt = AQOPredictDetailsMemCtx;
+		prediction_details = hash_create("AQO prediction details",
+										 64,	/* start small and extend */
+										 &hash_ctl,
+										 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	INSTR_TIME_SET_CURRENT(now);
+	INSTR_TIME_SUBTRACT(now, *start);
+
+	entry = (PredictionDetails *) hash_search(prediction_details, &fss,
+											  HASH_ENTER, NULL);
+	entry->source = source;
+	entry->model_rows = model_rows;
+	entry->nn_distance = nn_distance;
+	entry->predict_time = INSTR_TIME_GET_MILLISEC(now);
+}
+
+void
+prediction_details_clear(void)
+{
+	if (AQOPredictDetailsMemCtx == NULL)
+	{
+		Assert(prediction_details == NULL);
+		return;
+	}
+
+	/* The hash table lives in the context, so just forget about it */
+	MemoryContextReset(AQOPredictDetailsMemCtx);
+	prediction_details = NULL;
+}
+
+/*
+ * Copy provenance of the prediction, made for the fss of the node.
+ */
+static void
+fill_prediction_details(AQOPlanNode *node)
+{
+	PredictionDetails *entry = NULL;
+
+	if (prediction_details != NULL)
+		entry = (PredictionDetails *) hash_search(prediction_details,
+												  &node->fss, HASH_FIND, NULL);
+	if (entry == NULL)
+		return;
+
+	node->source = entry->source;
+	node->model_rows = entry->model_rows;
+	node->nn_distance = entry->nn_distance;
+	node->predict_time = entry->predict_time;
+}
+
 /* Ensure that it's postgres_fdw's foreign server oid */
 static bool
 is_postgres_fdw_server(Oid serverid)
@@ -288,9 +391,26 @@ subplan_hunter(Node *node, void *context)
 }
 
 /*
- * Get independent copy of the clauses list.
- * During this operation clauses could be changed and we couldn't walk across
- * this list next.
+ * Cheap check: does the expression contain any SubPlan node?
+ */
+static bool
+subplan_detector(Node *node, void *context)
+{
+	if (node == NULL)
+		return false;
+
+	if (IsA(node, SubPlan))
+		return true;
+
+	return expression_tree_walker(node, subplan_detector, context);
+}
+
+/*
+ * Get a list of clauses, suitable for the AQO hashing machinery.
+ * SubPlan nodes are rare, so a RestrictInfo is copied and mutated only if its
+ * clause contains a subplan: in that case we replace the subplan by its
+ * feature space value. Any other RestrictInfo is shared with the planner by
+ * reference. So, caller must not change the returned clauses, only the list.
  */
 List *
 aqo_get_clauses(PlannerInfo *root, List *restrictlist)
@@ -302,10 +422,14 @@ aqo_get_clauses(PlannerInfo *root, List *restrictlist)
 	{
 		RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
 
-		rinfo = copyObject(rinfo);
-		rinfo->clause = (Expr *) expression_tree_mutator((Node *) rinfo->clause,
-														 subplan_hunter,
-														 (void *) root);
+		if (subplan_detector((Node *) rinfo->clause, NULL))
+		{
+			rinfo = copyObject(rinfo);
+			rinfo->clause = (Expr *) expression_tree_mutator(
+														(Node *) rinfo->clause,
+														subplan_hunter,
+														(void *) root);
+		}
 		clauses = lappend(clauses, (void *) rinfo);
 	}
 	return clauses;
@@ -315,7 +439,8 @@ aqo_get_clauses(PlannerInfo *root, List *restrictlist)
  * For given path returns the list of all clauses used in it.
  * Also returns selectivities for the clauses throw the selectivities variable.
  * Both clauses and selectivities returned lists are copies and therefore
- * may be modified without corruption of the input data.
+ * may be modified without corruption of the input data. Note that clauses
+ * themselves may be shared with the planner (see aqo_get_clauses).
  */
 List *
 get_path_clauses(Path *path, PlannerInfo *root, List **selectivities)
@@ -514,20 +639,13 @@ is_appropriate_path(Path *path)
  * store AQO prediction in the same context, as the plan. So, explicitly free
  * all unneeded data.
  */
-void
-aqo_create_plan_hook(PlannerInfo *root, Path *src, Plan **dest)
+static void
+aqo_create_plan_internal(PlannerInfo *root, Path *src, Plan **dest)
 {
 	bool			is_join_path;
 	Plan		   *plan = *dest;
 	AQOPlanNode	   *node;
 
-	if (prev_create_plan_hook)
-		prev_create_plan_hook(root, src, dest);
-
-	if (!query_context.use_aqo && !query_context.learn_aqo &&
-		!query_context.collect_stat)
-		return;
-
 	is_join_path = (src->type == T_NestPath || src->type == T_MergePath ||
 					src->type == T_HashPath ||
 					(src->type == T_ForeignPath && IS_JOIN_REL(src->parent)));
@@ -581,8 +699,13 @@ aqo_create_plan_hook(PlannerInfo *root, Path *src, Plan **dest)
 		/* Get TLE's from child target list corresponding to the list of exprs. */
 		List *groupExprs = get_sortgrouplist_exprs(ap->groupClause,
 												(*dest)->lefttree->targetlist);
-		/* Copy bare expressions for further AQO learning case. */
-		node->grouping_exprs = copyObject(groupExprs);
+		/*
+		 * Learning needs only a hash of the grouping expressions. Compute it
+		 * here instead of keeping a copy of the expressions in the plan.
+		 */
+		node->ngrouping_exprs = list_length(groupExprs);
+		node->grouping_exprs_hash = get_grouping_exprs_hash(groupExprs);
+		list_free(groupExprs);
 		get_list_of_relids(root, ap->subpath->parent->relids, node->rels);
 		node->jointype = JOIN_INNER;
 	}
@@ -616,9 +739,29 @@ aqo_create_plan_hook(PlannerInfo *root, Path *src, Plan **dest)
 		node->fss = src->parent->fss_hash;
 	}
 
+	if (aqo_show_provenance)
+		fill_prediction_details(node);
+
 	node->had_path = true;
 }
 
+void
+aqo_create_plan_hook(PlannerInfo *root, Path *src, Plan **dest)
+{
+	instr_time	start;
+
+	if (prev_create_plan_hook)
+		prev_create_plan_hook(root, src, dest);
+
+	if (!query_context.use_aqo && !query_context.learn_aqo &&
+		!query_context.collect_stat)
+		return;
+
+	aqo_overhead_start(&start);
+	aqo_create_plan_internal(root, src, dest);
+	aqo_overhead_stop(AQO_HOOK_CREATE_PLAN, &start, true);
+}
+
 static void
 AQOnodeCopy(struct ExtensibleNode *enew, const struct ExtensibleNode *eold)
 {
@@ -638,8 +781,16 @@ AQOnodeCopy(struct ExtensibleNode *enew, const struct ExtensibleNode *eold)
 	new->rels->signatures = list_copy(old->rels->signatures);
 
 	new->clauses = copyObject(old->clauses);
-	new->grouping_exprs = copyObject(old->grouping_exprs);
 	new->selectivities = copyObject(old->selectivities);
+
+	if (old->nfeatures > 0)
+	{
+		new->features = palloc(sizeof(double) * old->nfeatures);
+		memcpy(new->features, old->features,
+			   sizeof(double) * old->nfeatures);
+	}
+	else
+		new->features = NULL;
 	enew = (ExtensibleNode *) new;
 }
 
@@ -673,20 +824,29 @@ AQOnodeEqual(const struct ExtensibleNode *a, const struct ExtensibleNode *b)
 /*
  * Serialize AQO plan node to a string.
  *
- * Right now we can't correctly serialize all fields of the node. Taking into
- * account that this action needed when a plan moves into parallel workers or
- * just during debugging, we serialize it only partially, just for debug
- * purposes.
- * Some extensions may manipulate by parts of serialized plan too.
+ * The plan is passed to parallel workers in a string form. Workers don't learn:
+ * the leader learns on the plan with the instrumentation of the workers merged.
+ * So, only the fields, computed during the planning, are written. Clauses can't
+ * be written at all: they can contain planner-only nodes, like PlaceHolderVar,
+ * which the core can't read back.
  */
 static void
 AQOnodeOut(struct StringInfoData *str, const struct ExtensibleNode *enode)
 {
 	AQOPlanNode *node = (AQOPlanNode *) enode;
 
+	WRITE_INT_FIELD(ngrouping_exprs);
+	WRITE_INT_FIELD(grouping_exprs_hash);
+	WRITE_ENUM_FIELD(jointype, JoinType);
+	WRITE_FLOAT_FIELD(parallel_divisor, "%.17g");
+
 	/* For Adaptive optimization DEBUG purposes */
 	WRITE_INT_FIELD(fss);
 	WRITE_FLOAT_FIELD(prediction, "%.0f");
+	WRITE_ENUM_FIELD(source, AqoEstimationSource);
+	WRITE_INT_FIELD(model_rows);
+	WRITE_FLOAT_FIELD(nn_distance, "%.17g");
+	WRITE_FLOAT_FIELD(predict_time, "%.17g");
 }
 
 /* Read an integer field (anything written as ":fldname %d") */
@@ -722,7 +882,8 @@ AQOnodeOut(struct StringInfoData *str, const struct ExtensibleNode *enode)
 /*
  * Deserialize AQO plan node from a string to internal representation.
  *
- * Should work in coherence with AQOnodeOut().
+ * Should work in coherence with AQOnodeOut(). The node has no path data, so
+ * nobody learns on it.
  */
 static void
 AQOnodeRead(struct ExtensibleNode *enode)
@@ -732,18 +893,27 @@ AQOnodeRead(struct ExtensibleNode *enode)
 	int			length;
 
 	local_node->had_path = false;
-	local_node->jointype = 0;
-	local_node->parallel_divisor = 1.0;
 	local_node->was_parametrized = false;
+	local_node->learn_fss = 0;
+	local_node->nfeatures = -1;
+	local_node->features = NULL;
 
 	local_node->rels = palloc0(sizeof(RelSortOut));
 	local_node->clauses = NIL;
 	local_node->selectivities = NIL;
-	local_node->grouping_exprs = NIL;
+
+	READ_INT_FIELD(ngrouping_exprs);
+	READ_INT_FIELD(grouping_exprs_hash);
+	READ_ENUM_FIELD(jointype, JoinType);
+	READ_FLOAT_FIELD(parallel_divisor);
 
 	/* For Adaptive optimization DEBUG purposes */
 	READ_INT_FIELD(fss);
 	READ_FLOAT_FIELD(prediction);
+	READ_ENUM_FIELD(source, AqoEstimationSource);
+	READ_INT_FIELD(model_rows);
+	READ_FLOAT_FIELD(nn_distance);
+	READ_FLOAT_FIELD(predict_time);
 }
 
 static const ExtensibleNodeMethods method =
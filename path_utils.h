@@ -5,6 +5,7 @@
 #include "nodes/pathnodes.h"
 #include "optimizer/planmain.h"
 #include "optimizer/planner.h"
+#include "portability/instr_time.h"
 
 #define AQO_PLAN_NODE	"AQOPlanNode"
 
@@ -21,6 +22,19 @@ typedef struct
 						 * table or on a table structure for temp table */
 } RelSortOut;
 
+/*
+ * Source of the cardinality estimation of a plan node, shown by the EXPLAIN
+ * with aqo.show_provenance.
+ */
+typedef enum AqoEstimationSource
+{
+	AQO_SOURCE_NONE = 0,		/* AQO didn't estimate the node */
+	AQO_SOURCE_EXACT,			/* model of the feature space of the query */
+	AQO_SOURCE_WIDE,			/* model, found by the wide search */
+	AQO_SOURCE_GROUPS,			/* model of the number of groups */
+	AQO_SOURCE_FALLBACK			/* no model, the standard estimation is used */
+} AqoEstimationSource;
+
 /*
  * information for adaptive query optimization
  */
@@ -32,16 +46,35 @@ typedef struct AQOPlanNode
 	List		   *clauses;
 	List		   *selectivities;
 
-	/* Grouping expressions from a target list. */
-	List		*grouping_exprs;
+	/*
+	 * Grouping expressions from a target list. Learning doesn't need the
+	 * expressions themselves, so store their number and a hash only.
+	 */
+	int			ngrouping_exprs;
+	int			grouping_exprs_hash;
 
 	JoinType	jointype;
 	double		parallel_divisor;
 	bool		was_parametrized;
 
+	/*
+	 * Feature subspace and features of the node as the learning stage sees
+	 * them. Computed at the end of planning to save learning from hashing of
+	 * the subtree clauses. Negative nfeatures means they are unknown.
+	 */
+	int			learn_fss;
+	int			nfeatures;
+	double	   *features;
+
 	/* For Adaptive optimization DEBUG purposes */
 	int		fss;
 	double	prediction;
+
+	/* Provenance of the prediction, filled with aqo.show_provenance only */
+	AqoEstimationSource	source;
+	int		model_rows;		/* rows of the model, used for the prediction */
+	double	nn_distance;	/* distance to the nearest neighbour or -1 */
+	double	predict_time;	/* time of the prediction in ms or -1 */
 } AQOPlanNode;
 
 
@@ -67,6 +100,11 @@ extern List *get_path_clauses(Path *path,
 							  PlannerInfo *root,
 							  List **selectivities);
 
+extern void prediction_details_store(int fss, AqoEstimationSource source,
+									 int model_rows, double nn_distance,
+									 instr_time *start);
+extern void prediction_details_clear(void);
+
 extern void aqo_create_plan_hook(PlannerInfo *root, Path *src, Plan **dest);
 extern AQOPlanNode *get_aqo_plan_node(Plan *plan, bool create);
 extern void RegisterAQOPlanNodeMethods(void);
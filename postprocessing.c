@@ -19,12 +19,21 @@
 #include "postgres.h"
 
 #include "access/parallel.h"
+#include "common/pg_prng.h"
+#include "executor/instrument.h"
+#include "miscadmin.h"
+#include "nodes/nodeFuncs.h"
 #include "optimizer/optimizer.h"
 #include "postgres_fdw.h"
+#include "utils/hsearch.h"
 #include "utils/queryenvironment.h"
 
 #include "aqo.h"
+#include "aqo_shared.h"
+#include "aqo_trace.h"
+#include "counters.h"
 #include "hash.h"
+#include "learn_queue.h"
 #include "path_utils.h"
 #include "machine_learning.h"
 #include "preprocessing.h"
@@ -33,6 +42,31 @@
 
 bool aqo_learn_statement_timeout = false;
 
+/*
+ * Learn on a plan of a statement, interrupted by an error or a cancellation.
+ */
+bool aqo_learn_on_abort = false;
+
+/*
+ * Relative error of the AQO prediction of a plan node, small enough to skip
+ * learning on the node. Zero means learning on each node.
+ */
+double aqo_learn_tolerance = 0.;
+
+/*
+ * Count rows of plan nodes with AQO's own ExecProcNode wrapper instead of the
+ * INSTRUMENT_ROWS instrumentation, if possible.
+ */
+bool aqo_lightweight_instrumentation = false;
+
+/*
+ * Executions faster than aqo_min_execution_time microseconds are only counted
+ * in the query class statistics. aqo_fast_execution_sample_rate of them still
+ * pass the full learning and statistics path to keep the models fresh.
+ */
+int aqo_min_execution_time = 0;
+double aqo_fast_execution_sample_rate = 0.01;
+
 typedef struct
 {
 	List *clauselist;
@@ -42,6 +76,72 @@ typedef struct
 	bool isTimedOut; /* Is execution was interrupted by timeout? */
 } aqo_obj_stat;
 
+/*
+ * Learning samples of one query are grouped by feature subspace and applied
+ * to the knowledge base at the end of the plan walk with one load and one
+ * store per feature subspace.
+ */
+typedef struct
+{
+	uint64	fs;
+	int		fss;
+	int		ncols;
+} LearnBatchKey;
+
+typedef struct
+{
+	double *features;
+	double	target;
+	double	rfactor;
+} LearnBatchSample;
+
+typedef struct
+{
+	LearnBatchKey	key;
+	List		   *samples;
+	List		   *reloids;
+} LearnBatchEntry;
+
+/* Live in the AQOLearnMemCtx */
+static HTAB *learn_batch = NULL;
+static List *learn_batch_entries = NIL; /* in order of the first sample */
+
+/* Numbers of learned and skipped samples of the batch */
+static int64 learned_samples = 0;
+static int64 skipped_samples = 0;
+
+/*
+ * Snapshot of the learnable nodes of the running top-level statement, for the
+ * case it is interrupted by an error (see aqo.learn_on_abort). Everything,
+ * needed for learning, is copied at the executor start, so the capture at the
+ * error only reads row counters of the nodes. The samples are learned at the
+ * start of the next top-level statement, in a healthy transaction.
+ */
+typedef struct
+{
+	PlanState  *ps;			/* NULL, when the counters are captured */
+	uint64		fs;
+	int			fss;
+	int			ncols;
+	double	   *features;
+	List	   *reloids;
+	double		predicted;
+	double		prediction;
+
+	/* Counters of the node at the moment of the error */
+	double		ntuples;
+	double		nloops;
+	bool		finished;
+} AbortSample;
+
+static MemoryContext AQOAbortMemCtx = NULL;
+static List *abort_snapshot = NIL; /* of AbortSample, in the AQOAbortMemCtx */
+static QueryDesc *abort_snapshot_owner = NULL;
+static uint64 abort_snapshot_queryid = 0;
+static bool abort_snapshot_captured = false;
+
+static int exec_nested_level = 0;
+
 static double cardinality_sum_errors;
 static int	cardinality_num_objects;
 static int64 max_timeout_value;
@@ -61,9 +161,13 @@ static char *PlanStateInfo = "PlanStateInfo";
 
 /* Query execution statistics collecting utilities */
 static void atomic_fss_learn_step(uint64 fhash, int fss, OkNNrdata *data,
-								  double *features, double target,
-								  double rfactor, List *reloids);
+								  List *samples, List *reloids);
+static void learn_on_abort_apply(void);
+static void timeout_learn_account(void);
+static void learn_on_abort_snapshot(QueryDesc *queryDesc, bool use_aqo);
+static void abort_snapshot_reset(void);
 static bool learnOnPlanState(PlanState *p, void *context);
+static bool planFeaturesWalker(Plan *plan, aqo_obj_stat *ctx);
 static void learn_agg_sample(aqo_obj_stat *ctx, RelSortOut *rels,
 							 double learned, double rfactor, Plan *plan,
 							 bool notExecuted);
@@ -86,14 +190,152 @@ static bool ExtractFromQueryEnv(QueryDesc *queryDesc);
  */
 static void
 atomic_fss_learn_step(uint64 fs, int fss, OkNNrdata *data,
-					  double *features, double target, double rfactor,
-					  List *reloids)
+					  List *samples, List *reloids)
 {
+	ListCell   *lc;
+	instr_time	start;
+
+	TRACE_AQO_LEARN_START(fs, fss, list_length(samples));
+	INSTR_TIME_SET_ZERO(start);
+	if (TRACE_AQO_LEARN_DONE_ENABLED())
+		INSTR_TIME_SET_CURRENT(start);
+
 	if (!load_fss_ext(fs, fss, data, NULL))
 		data->rows = 0;
 
-	data->rows = OkNNr_learn(data, features, target, rfactor);
+	foreach(lc, samples)
+	{
+		LearnBatchSample *sample = (LearnBatchSample *) lfirst(lc);
+
+		data->rows = OkNNr_learn(data, sample->features, sample->target,
+								 sample->rfactor);
+	}
+
 	update_fss_ext(fs, fss, data, reloids);
+
+	if (TRACE_AQO_LEARN_DONE_ENABLED() && !INSTR_TIME_IS_ZERO(start))
+		TRACE_AQO_LEARN_DONE(fs, fss, data->rows, aqo_trace_elapsed(start));
+}
+
+/*
+ * Prepare an empty batch of learning samples before the plan walk.
+ */
+void
+learn_batch_begin(void)
+{
+	HASHCTL		ctl;
+
+	ctl.keysize = sizeof(LearnBatchKey);
+	ctl.entrysize = sizeof(LearnBatchEntry);
+	ctl.hcxt = AQOLearnMemCtx;
+	learn_batch = hash_create("AQO learning batch", 64, &ctl,
+							  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	learn_batch_entries = NIL;
+	learned_samples = 0;
+	skipped_samples = 0;
+}
+
+void
+learn_batch_add(uint64 fs, int fss, int ncols, double *features,
+				double target, double rfactor, List *reloids)
+{
+	MemoryContext		oldctx = MemoryContextSwitchTo(AQOLearnMemCtx);
+	LearnBatchKey		key;
+	LearnBatchEntry	   *entry;
+	LearnBatchSample   *sample;
+	bool				found;
+
+	Assert(learn_batch != NULL);
+
+	/* Zero the padding, the key is hashed as a blob */
+	memset(&key, 0, sizeof(key));
+	key.fs = fs;
+	key.fss = fss;
+	key.ncols = ncols;
+
+	entry = (LearnBatchEntry *) hash_search(learn_batch, &key, HASH_ENTER,
+											&found);
+	if (!found)
+	{
+		entry->samples = NIL;
+		learn_batch_entries = lappend(learn_batch_entries, entry);
+	}
+
+	sample = palloc(sizeof(LearnBatchSample));
+	sample->features = features;
+	sample->target = target;
+	sample->rfactor = rfactor;
+	entry->samples = lappend(entry->samples, sample);
+	learned_samples++;
+
+	/* The last stored sample defined the list of relations before */
+	entry->reloids = reloids;
+
+	MemoryContextSwitchTo(oldctx);
+}
+
+/*
+ * Apply the collected samples to the knowledge base. If learning workers are
+ * running, the samples are passed to them instead.
+ *
+ * A learning worker sets 'queued': the samples came from the learning queue
+ * and were counted by the backends, which pushed them.
+ */
+void
+learn_batch_apply(bool queued)
+{
+	ListCell   *lc;
+
+	/* Pass the whole batch to the workers under one lock of the queue */
+	if (!queued && learn_batch_entries != NIL && learn_queue_lock())
+	{
+		foreach(lc, learn_batch_entries)
+		{
+			LearnBatchEntry	   *entry = (LearnBatchEntry *) lfirst(lc);
+			List			   *samples = NIL;
+			ListCell		   *lc2;
+
+			foreach(lc2, entry->samples)
+			{
+				LearnBatchSample *sample = (LearnBatchSample *) lfirst(lc2);
+
+				if (!learn_queue_push(entry->key.fs, entry->key.fss,
+									  entry->key.ncols, sample->features,
+									  sample->target, sample->rfactor,
+									  entry->reloids))
+					samples = lappend(samples, sample);
+			}
+
+			/* Samples, left to learn synchronously */
+			entry->samples = samples;
+		}
+		learn_queue_unlock();
+	}
+
+	foreach(lc, learn_batch_entries)
+	{
+		LearnBatchEntry	   *entry = (LearnBatchEntry *) lfirst(lc);
+		OkNNrdata		   *data;
+
+		if (entry->samples == NIL)
+			continue;
+
+		data = OkNNr_allocate(entry->key.ncols);
+
+		/* Critical section */
+		atomic_fss_learn_step(entry->key.fs, entry->key.fss, data,
+							  entry->samples, entry->reloids);
+		/* End of critical section */
+	}
+
+	if (!queued && learned_samples > 0)
+		pg_atomic_fetch_add_u64(&aqo_state->learned_samples, learned_samples);
+	if (!queued && skipped_samples > 0)
+		pg_atomic_fetch_add_u64(&aqo_state->skipped_samples, skipped_samples);
+
+	/* The memory is released with the AQOLearnMemCtx */
+	learn_batch = NULL;
+	learn_batch_entries = NIL;
 }
 
 static void
@@ -104,7 +346,6 @@ learn_agg_sample(aqo_obj_stat *ctx, RelSortOut *rels,
 	uint64			fs = query_context.fspace_hash;
 	int				child_fss;
 	double			target;
-	OkNNrdata	   *data = OkNNr_allocate(0);
 	int				fss;
 
 	/*
@@ -115,15 +356,21 @@ learn_agg_sample(aqo_obj_stat *ctx, RelSortOut *rels,
 		return;
 
 	target = log(learned);
-	child_fss = get_fss_for_object(rels->signatures, ctx->clauselist,
-								   NIL, NULL,NULL);
-	fss = get_grouped_exprs_hash(child_fss,
-								 aqo_node ? aqo_node->grouping_exprs : NIL);
-
-	/* Critical section */
-	atomic_fss_learn_step(fs, fss, data, NULL,
-						  target, rfactor, rels->hrels);
-	/* End of critical section */
+
+	if (aqo_node && aqo_node->nfeatures >= 0)
+		/* Feature subspace is already known since planning */
+		fss = aqo_node->learn_fss;
+	else
+	{
+		child_fss = get_fss_for_object(rels->signatures, ctx->clauselist,
+									   NIL, NULL,NULL);
+		fss = get_grouped_exprs_hash(child_fss,
+									 (aqo_node && aqo_node->ngrouping_exprs > 0) ?
+										aqo_node->grouping_exprs_hash :
+										get_grouping_exprs_hash(NIL));
+	}
+
+	learn_batch_add(fs, fss, 0, NULL, target, rfactor, rels->hrels);
 }
 
 /*
@@ -138,16 +385,24 @@ learn_sample(aqo_obj_stat *ctx, RelSortOut *rels,
 	uint64			fs = query_context.fspace_hash;
 	double		   *features;
 	double			target;
-	OkNNrdata	   *data;
 	int				fss;
 	int				ncols;
 
 	target = log(learned);
-	fss = get_fss_for_object(rels->signatures, ctx->clauselist,
-							 ctx->selectivities, &ncols, &features);
+
+	if (aqo_node && aqo_node->nfeatures >= 0)
+	{
+		/* Features are already known since planning */
+		fss = aqo_node->learn_fss;
+		ncols = aqo_node->nfeatures;
+		features = aqo_node->features;
+	}
+	else
+		fss = get_fss_for_object(rels->signatures, ctx->clauselist,
+								 ctx->selectivities, &ncols, &features);
 
 	/* Only Agg nodes can have non-empty a grouping expressions list. */
-	Assert(!IsA(plan, Agg) || !aqo_node || aqo_node->grouping_exprs != NIL);
+	Assert(!IsA(plan, Agg) || !aqo_node || aqo_node->ngrouping_exprs > 0);
 
 	/*
 	 * Learn 'not executed' nodes only once, if no one another knowledge exists
@@ -156,11 +411,7 @@ learn_sample(aqo_obj_stat *ctx, RelSortOut *rels,
 	if (notExecuted && aqo_node && aqo_node->prediction > 0)
 		return;
 
-	data = OkNNr_allocate(ncols);
-
-	/* Critical section */
-	atomic_fss_learn_step(fs, fss, data, features, target, rfactor, rels->hrels);
-	/* End of critical section */
+	learn_batch_add(fs, fss, ncols, features, target, rfactor, rels->hrels);
 }
 
 /*
@@ -444,7 +695,7 @@ learnOnPlanState(PlanState *p, void *context)
 		/* No AQO prediction. Parallel workers not used for this plan node. */
 		predicted = p->plan->plan_rows;
 
-	if (!ctx->learn && query_context.collect_stat)
+	if (!ctx->learn && !query_context.learn_aqo)
 	{
 		double p,l;
 
@@ -456,12 +707,6 @@ learnOnPlanState(PlanState *p, void *context)
 		cardinality_num_objects += 1;
 		return false;
 	}
-	else if (!ctx->learn)
-		return true;
-
-	/*
-	 * Need learn.
-	 */
 
 	/*
 	 * It is needed for correct exp(result) calculation.
@@ -478,6 +723,17 @@ learnOnPlanState(PlanState *p, void *context)
 		cardinality_num_objects += 1;
 	}
 
+	/*
+	 * The execution isn't sampled for learning. The error is computed the same
+	 * way as for the learned ones to detect its drift.
+	 */
+	if (!ctx->learn)
+		return false;
+
+	/*
+	 * Need learn.
+	 */
+
 	/*
 	 * Some nodes inserts after planning step (See T_Hash node type).
 	 * In this case we haven't AQO prediction and fss record.
@@ -510,7 +766,18 @@ learnOnPlanState(PlanState *p, void *context)
 
 				Assert(predicted >= 1. && learn_rows >= 1.);
 
-				if (should_learn(p, aqo_node, ctx, predicted, learn_rows, &rfactor))
+				if (aqo_learn_tolerance > 0. && !notExecuted &&
+					!ctx->isTimedOut && query_context.use_aqo &&
+					aqo_node->prediction > 0. &&
+					fabs(log(predicted) - log(learn_rows)) <=
+												log(1. + aqo_learn_tolerance))
+					/*
+					 * AQO already predicts this node accurately enough. Don't
+					 * waste time on hashing and access to the knowledge base.
+					 */
+					skipped_samples++;
+				else if (should_learn(p, aqo_node, ctx, predicted, learn_rows,
+									  &rfactor))
 				{
 					if (IsA(p, AggState))
 						learn_agg_sample(&SubplanCtx,
@@ -533,12 +800,205 @@ end:
 	return false;
 }
 
+/*
+ * Walks the plan tree in the same order, as learnOnPlanState() walks the plan
+ * state tree, collects clauses and selectivities of each subtree and stores
+ * feature subspace and features of the subtree into the AQO node on its top.
+ * So, learning on the plan doesn't need to hash the clauses again.
+ *
+ * Returns false if the executor can see another set of plan nodes (run-time
+ * partition pruning, custom scans) and features of the upper nodes can't be
+ * computed in advance.
+ */
+static bool
+planFeaturesWalker(Plan *plan, aqo_obj_stat *ctx)
+{
+	aqo_obj_stat	SubplanCtx = {NIL, NIL, NIL, ctx->learn, ctx->isTimedOut};
+	List		   *children = NIL;
+	AQOPlanNode	   *aqo_node;
+	bool			reliable = true;
+	ListCell	   *lc;
+
+	if (plan == NULL)
+		return true;
+
+	switch (nodeTag(plan))
+	{
+		case T_Append:
+			children = ((Append *) plan)->appendplans;
+			reliable = (((Append *) plan)->part_prune_info == NULL);
+			break;
+		case T_MergeAppend:
+			children = ((MergeAppend *) plan)->mergeplans;
+			reliable = (((MergeAppend *) plan)->part_prune_info == NULL);
+			break;
+		case T_BitmapAnd:
+			children = ((BitmapAnd *) plan)->bitmapplans;
+			break;
+		case T_BitmapOr:
+			children = ((BitmapOr *) plan)->bitmapplans;
+			break;
+		case T_SubqueryScan:
+			children = list_make1(((SubqueryScan *) plan)->subplan);
+			break;
+		case T_CustomScan:
+			reliable = (((CustomScan *) plan)->custom_plans == NIL);
+			break;
+		default:
+			break;
+	}
+
+	reliable &= planFeaturesWalker(plan->lefttree, &SubplanCtx);
+	reliable &= planFeaturesWalker(plan->righttree, &SubplanCtx);
+	foreach(lc, children)
+		reliable &= planFeaturesWalker((Plan *) lfirst(lc), &SubplanCtx);
+
+	aqo_node = get_aqo_plan_node(plan, false);
+	if (aqo_node != NULL && aqo_node->had_path)
+	{
+		List   *cur_selectivities;
+
+		cur_selectivities = restore_selectivities(aqo_node->clauses,
+												  aqo_node->rels->hrels,
+												  aqo_node->jointype,
+												  aqo_node->was_parametrized);
+		SubplanCtx.selectivities = list_concat(SubplanCtx.selectivities,
+											   cur_selectivities);
+		SubplanCtx.clauselist = list_concat(SubplanCtx.clauselist,
+											list_copy(aqo_node->clauses));
+
+		if (reliable && aqo_node->rels->hrels != NIL)
+		{
+			List   *signatures = aqo_node->rels->signatures;
+			double *features = NULL;
+			int		ncols = 0;
+			int		fss;
+
+			if (IsA(plan, Agg))
+			{
+				int		child_fss;
+
+				/* See learn_agg_sample() */
+				child_fss = get_fss_for_object(signatures,
+											   SubplanCtx.clauselist,
+											   NIL, NULL, NULL);
+				fss = get_grouped_exprs_hash(child_fss,
+											 aqo_node->ngrouping_exprs > 0 ?
+												aqo_node->grouping_exprs_hash :
+												get_grouping_exprs_hash(NIL));
+			}
+			else
+				fss = get_fss_for_object(signatures, SubplanCtx.clauselist,
+										 SubplanCtx.selectivities,
+										 &ncols, &features);
+
+			/* Features must live as long as the plan itself */
+			if (ncols > 0)
+			{
+				aqo_node->features =
+					MemoryContextAlloc(GetMemoryChunkContext(aqo_node),
+									   sizeof(double) * ncols);
+				memcpy(aqo_node->features, features, sizeof(double) * ncols);
+			}
+			aqo_node->nfeatures = ncols;
+			aqo_node->learn_fss = fss;
+		}
+	}
+
+	ctx->clauselist = list_concat(ctx->clauselist, SubplanCtx.clauselist);
+	ctx->selectivities = list_concat(ctx->selectivities,
+									 SubplanCtx.selectivities);
+	return reliable;
+}
+
+/*
+ * Compute features of each AQO node of the planned statement in advance.
+ * Should be called at the end of planning when the selectivity cache is still
+ * valid. Temporary data is allocated in the AQOPredictMemCtx memory context.
+ */
+void
+aqo_store_plan_features(PlannedStmt *stmt)
+{
+	MemoryContext	oldctx;
+	ListCell	   *lc;
+
+	if (!query_context.learn_aqo)
+		return;
+
+	oldctx = MemoryContextSwitchTo(AQOPredictMemCtx);
+
+	/* Subplans and initplans are learned with their own context */
+	{
+		aqo_obj_stat ctx = {NIL, NIL, NIL, true, false};
+
+		(void) planFeaturesWalker(stmt->planTree, &ctx);
+	}
+
+	foreach(lc, stmt->subplans)
+	{
+		aqo_obj_stat ctx = {NIL, NIL, NIL, true, false};
+
+		(void) planFeaturesWalker((Plan *) lfirst(lc), &ctx);
+	}
+
+	MemoryContextSwitchTo(oldctx);
+}
+
 /*****************************************************************************
  *
  *	QUERY EXECUTION STATISTICS COLLECTING HOOKS
  *
  *****************************************************************************/
 
+/*
+ * ExecProcNode wrapper, which counts tuples and loops of the node only. It
+ * replaces the ExecProcNodeInstr() of the INSTRUMENT_ROWS instrumentation:
+ * the counters are stored in the same Instrumentation struct, so rescans,
+ * MultiExecProcNode() and learning work with them as usual, but without the
+ * calls of InstrStartNode() and InstrStopNode() on each tuple.
+ */
+static TupleTableSlot *
+ExecProcNodeRowCount(PlanState *node)
+{
+	TupleTableSlot *result = node->ExecProcNodeReal(node);
+
+	if (!TupIsNull(result))
+		node->instrument->tuplecount += 1.;
+	node->instrument->running = true;
+
+	return result;
+}
+
+/*
+ * The same as ExecProcNodeFirst() does: check stack depth on the first call
+ * only.
+ */
+static TupleTableSlot *
+ExecProcNodeRowCountFirst(PlanState *node)
+{
+	check_stack_depth();
+
+	node->ExecProcNode = ExecProcNodeRowCount;
+	return ExecProcNodeRowCount(node);
+}
+
+/*
+ * Allocate row counters for each node of the initialized plan state tree.
+ * Must be called before the first execution of the plan.
+ */
+static bool
+install_row_counters(PlanState *ps, void *context)
+{
+	if (ps->instrument != NULL)
+		/* The subplan is referenced twice */
+		return false;
+
+	ps->instrument = InstrAlloc(1, 0, ps->async_capable);
+	ps->ExecProcNode = ExecProcNodeRowCountFirst;
+
+	return planstate_tree_walker(ps, install_row_counters, context);
+}
+
 /*
  * Set up flags to store cardinality statistics.
  */
@@ -547,6 +1007,14 @@ aqo_ExecutorStart(QueryDesc *queryDesc, int eflags)
 {
 	instr_time now;
 	bool use_aqo;
+	bool row_counters = false;
+
+	/* Learn on the previous statement, interrupted by an error */
+	if (exec_nested_level <= 0 && !IsParallelWorker())
+	{
+		timeout_learn_account();
+		learn_on_abort_apply();
+	}
 
 	/*
 	 * If the plan pulled from a plan cache, planning don't needed. Restore
@@ -566,6 +1034,14 @@ aqo_ExecutorStart(QueryDesc *queryDesc, int eflags)
 			INSTR_TIME_SET_CURRENT(now);
 			INSTR_TIME_SUBTRACT(now, query_context.start_planning_time);
 			query_context.planning_time = INSTR_TIME_GET_DOUBLE(now);
+
+			if (aqo_planning_overhead_limit > 0. && query_context.use_aqo &&
+				query_context.planning_time > 0. &&
+				!INSTR_TIME_IS_ZERO(query_context.predict_time))
+				(void) update_query_plan_overhead(query_context.query_hash,
+						INSTR_TIME_GET_DOUBLE(query_context.predict_time) /
+												query_context.planning_time,
+						query_context.max_join_rels);
 		}
 		else
 			/*
@@ -588,7 +1064,19 @@ aqo_ExecutorStart(QueryDesc *queryDesc, int eflags)
 
 		if ((query_context.learn_aqo || force_collect_stat) &&
 			!query_context.explain_only)
-			queryDesc->instrument_options |= INSTRUMENT_ROWS;
+		{
+			/*
+			 * Row counters can't be used if somebody else wants the
+			 * instrumentation or parallel workers need to pass their
+			 * instrumentation to the leader.
+			 */
+			if (aqo_lightweight_instrumentation &&
+				queryDesc->instrument_options == 0 &&
+				!queryDesc->plannedstmt->parallelModeNeeded)
+				row_counters = true;
+			else
+				queryDesc->instrument_options |= INSTRUMENT_ROWS;
+		}
 
 		/* Save all query-related parameters into the query context. */
 		StoreToQueryEnv(queryDesc);
@@ -599,8 +1087,20 @@ aqo_ExecutorStart(QueryDesc *queryDesc, int eflags)
 	else
 		standard_ExecutorStart(queryDesc, eflags);
 
+	if (row_counters && queryDesc->planstate != NULL)
+	{
+		MemoryContext oldctx;
+
+		oldctx = MemoryContextSwitchTo(queryDesc->estate->es_query_cxt);
+		(void) install_row_counters(queryDesc->planstate, NULL);
+		MemoryContextSwitchTo(oldctx);
+	}
+
 	if (use_aqo)
 		StorePlanInternals(queryDesc);
+
+	if (exec_nested_level <= 0 && !IsParallelWorker())
+		learn_on_abort_snapshot(queryDesc, use_aqo);
 }
 
 #include "utils/timeout.h"
@@ -609,15 +1109,43 @@ static struct
 {
 	TimeoutId id;
 	QueryDesc *queryDesc;
-} timeoutCtl = {0, NULL};
+	bool learned; /* AQO has learned on the query in the timeout handler */
 
-static int exec_nested_level = 0;
+	/*
+	 * Time of the learning in the timeout handler and the query class to
+	 * account it to. The handler runs in the signal context, so it can't
+	 * flush the counters into the shared memory itself.
+	 */
+	instr_time learn_time;
+	uint64 learn_queryid;
+} timeoutCtl = {0, NULL, false};
+
+/*
+ * Account the learning, made by the timeout handler, to the query class.
+ * Called by the next hook of the top-level statement, which can flush the
+ * counters.
+ */
+static void
+timeout_learn_account(void)
+{
+	instr_time	learn_time = timeoutCtl.learn_time;
+	AqoLocalCounters saved;
+
+	if (INSTR_TIME_IS_ZERO(learn_time))
+		return;
+
+	INSTR_TIME_SET_ZERO(timeoutCtl.learn_time);
+	aqo_counters_save(&saved);
+	aqo_overhead_add(AQO_HOOK_LEARN, learn_time, true);
+	aqo_counters_restore(&saved, timeoutCtl.learn_queryid);
+}
 
 static void
 aqo_timeout_handler(void)
 {
 	MemoryContext oldctx = MemoryContextSwitchTo(AQOLearnMemCtx);
 	aqo_obj_stat ctx = {NIL, NIL, NIL, false, false};
+	instr_time	start;
 
 	if (!timeoutCtl.queryDesc || !ExtractFromQueryEnv(timeoutCtl.queryDesc))
 		return;
@@ -632,8 +1160,284 @@ aqo_timeout_handler(void)
 	else
 		elog(NOTICE, "[AQO] Time limit for execution of the statement was expired. AQO tried to learn on partial data. Timeout is "INT64_FORMAT, max_timeout_value);
 
+	aqo_overhead_start(&start);
+	learn_batch_begin();
 	learnOnPlanState(timeoutCtl.queryDesc->planstate, (void *) &ctx);
+	learn_batch_apply(false);
+	if (!INSTR_TIME_IS_ZERO(start))
+	{
+		INSTR_TIME_SET_CURRENT(timeoutCtl.learn_time);
+		INSTR_TIME_SUBTRACT(timeoutCtl.learn_time, start);
+		timeoutCtl.learn_queryid = query_context.query_hash;
+	}
+	timeoutCtl.learned = true;
+	MemoryContextSwitchTo(oldctx);
+}
+
+/*
+ * Capture row counters of the snapshot nodes of a statement, interrupted by an
+ * error. Called in the error recovery, so it must not allocate memory or do
+ * anything else that can fail and replace the original error.
+ */
+static void
+learn_on_abort_capture(QueryDesc *queryDesc)
+{
+	ListCell   *lc;
+
+	if (abort_snapshot_owner != queryDesc || abort_snapshot_captured ||
+		timeoutCtl.learned)
+		return;
+
+	foreach(lc, abort_snapshot)
+	{
+		AbortSample		*sample = (AbortSample *) lfirst(lc);
+		Instrumentation *instr = sample->ps->instrument;
+
+		/* The same unification of counters as in the timeout case */
+		sample->ntuples = instr->ntuples;
+		sample->nloops = instr->nloops;
+		if (instr->running)
+		{
+			sample->ntuples += instr->tuplecount;
+			sample->nloops += 1;
+		}
+		sample->finished = !instr->running && instr->nloops > 0. &&
+						   TupIsNull(sample->ps->ps_ResultTupleSlot);
+
+		/* The plan state is released with the portal */
+		sample->ps = NULL;
+	}
+
+	abort_snapshot_captured = true;
+}
+
+/*
+ * Apply the captured samples of the aborted statement to the knowledge base.
+ * As with the timeout, only nodes whose actual rows already exceed the
+ * prediction or which have finished their work are learned, with reduced
+ * reliability.
+ */
+static void
+learn_on_abort_apply(void)
+{
+	List		   *samples = abort_snapshot;
+	MemoryContext	oldctx;
+	ListCell	   *lc;
+	instr_time		start;
+	AqoLocalCounters saved;
+
+	if (!abort_snapshot_captured)
+		return;
+
+	/* Don't retry, if the learning fails */
+	abort_snapshot = NIL;
+	abort_snapshot_owner = NULL;
+	abort_snapshot_captured = false;
+
+	aqo_counters_save(&saved);
+	aqo_overhead_start(&start);
+	oldctx = MemoryContextSwitchTo(AQOLearnMemCtx);
+	learn_batch_begin();
+
+	foreach(lc, samples)
+	{
+		AbortSample	   *sample = (AbortSample *) lfirst(lc);
+		double			learn_rows;
+		double			rfactor;
+
+		/* Not executed nodes aren't learned on partial data */
+		if (sample->nloops <= 0.)
+			continue;
+
+		learn_rows = clamp_row_est(sample->ntuples / sample->nloops);
+
+		if (learn_rows > sample->predicted * 1.2)
+			rfactor = RELIABILITY_MIN;
+		else if (sample->finished)
+			rfactor = 0.9 * (RELIABILITY_MAX - RELIABILITY_MIN);
+		else
+			continue;
+
+		learn_batch_add(sample->fs, sample->fss, sample->ncols,
+						sample->features, log(learn_rows), rfactor,
+						sample->reloids);
+	}
+
+	learn_batch_apply(false);
+
 	MemoryContextSwitchTo(oldctx);
+	aqo_memory_peak(AQO_MEMCTX_LEARN, AQOLearnMemCtx);
+	MemoryContextReset(AQOLearnMemCtx);
+	MemoryContextReset(AQOAbortMemCtx);
+	aqo_overhead_stop(AQO_HOOK_LEARN, &start, true);
+	aqo_counters_restore(&saved, abort_snapshot_queryid);
+}
+
+/*
+ * Forget the snapshot of the statement. The memory of the snapshot is reused.
+ */
+static void
+abort_snapshot_reset(void)
+{
+	if (AQOAbortMemCtx != NULL)
+		MemoryContextReset(AQOAbortMemCtx);
+	abort_snapshot = NIL;
+	abort_snapshot_owner = NULL;
+	abort_snapshot_captured = false;
+}
+
+static void
+abort_snapshot_add(PlanState *p, AQOPlanNode *aqo_node, aqo_obj_stat *ctx)
+{
+	AbortSample *sample = palloc0(sizeof(AbortSample));
+
+	sample->ps = p;
+	sample->fs = query_context.fspace_hash;
+	sample->prediction = aqo_node->prediction;
+	sample->predicted = clamp_row_est((aqo_node->prediction > 0. &&
+									   query_context.use_aqo) ?
+										aqo_node->prediction :
+										p->plan->plan_rows);
+
+	if (aqo_node->nfeatures >= 0)
+	{
+		/* Known since planning. The plan can be freed before the learning */
+		sample->fss = aqo_node->learn_fss;
+		sample->ncols = aqo_node->nfeatures;
+		if (sample->ncols > 0)
+		{
+			sample->features = palloc(sizeof(double) * sample->ncols);
+			memcpy(sample->features, aqo_node->features,
+				   sizeof(double) * sample->ncols);
+		}
+	}
+	else if (IsA(p, AggState))
+	{
+		int child_fss = get_fss_for_object(aqo_node->rels->signatures,
+										   ctx->clauselist, NIL, NULL, NULL);
+
+		sample->fss = get_grouped_exprs_hash(child_fss,
+								(aqo_node->ngrouping_exprs > 0) ?
+									aqo_node->grouping_exprs_hash :
+									get_grouping_exprs_hash(NIL));
+	}
+	else
+		sample->fss = get_fss_for_object(aqo_node->rels->signatures,
+										 ctx->clauselist, ctx->selectivities,
+										 &sample->ncols, &sample->features);
+
+	sample->reloids = list_copy(aqo_node->rels->hrels);
+	abort_snapshot = lappend(abort_snapshot, sample);
+}
+
+/*
+ * Walk the plan state tree and collect clauses and selectivities of the nodes
+ * in the same manner as learnOnPlanState does.
+ */
+static bool
+abort_snapshot_walker(PlanState *p, void *context)
+{
+	aqo_obj_stat   *ctx = (aqo_obj_stat *) context;
+	aqo_obj_stat	SubplanCtx = {NIL, NIL, NIL, true, true};
+	List		   *saved_subplan_list = p->subPlan;
+	List		   *saved_initplan_list = p->initPlan;
+	AQOPlanNode	   *aqo_node;
+	ListCell	   *lc;
+
+	p->subPlan = NIL;
+	p->initPlan = NIL;
+	(void) planstate_tree_walker(p, abort_snapshot_walker, &SubplanCtx);
+	p->subPlan = saved_subplan_list;
+	p->initPlan = saved_initplan_list;
+
+	/* Subplans are learned with their own contexts */
+	foreach(lc, saved_subplan_list)
+	{
+		SubPlanState *sps = lfirst_node(SubPlanState, lc);
+		aqo_obj_stat SPCtx = {NIL, NIL, NIL, true, true};
+
+		(void) abort_snapshot_walker(sps->planstate, &SPCtx);
+	}
+	foreach(lc, saved_initplan_list)
+	{
+		SubPlanState *sps = lfirst_node(SubPlanState, lc);
+		aqo_obj_stat SPCtx = {NIL, NIL, NIL, true, true};
+
+		(void) abort_snapshot_walker(sps->planstate, &SPCtx);
+	}
+
+	aqo_node = get_aqo_plan_node(p->plan, false);
+	if (aqo_node != NULL && aqo_node->had_path)
+	{
+		SubplanCtx.selectivities =
+			list_concat(SubplanCtx.selectivities,
+						restore_selectivities(aqo_node->clauses,
+											  aqo_node->rels->hrels,
+											  aqo_node->jointype,
+											  aqo_node->was_parametrized));
+		SubplanCtx.clauselist = list_concat(SubplanCtx.clauselist,
+											list_copy(aqo_node->clauses));
+
+		if (aqo_node->rels->hrels != NIL && p->instrument != NULL)
+			abort_snapshot_add(p, aqo_node, &SubplanCtx);
+	}
+
+	ctx->clauselist = list_concat(ctx->clauselist, SubplanCtx.clauselist);
+	ctx->selectivities = list_concat(ctx->selectivities,
+									 SubplanCtx.selectivities);
+	return false;
+}
+
+/*
+ * Make the snapshot of the top-level statement at the executor start. The
+ * snapshot of a previous statement is forgotten.
+ */
+static void
+learn_on_abort_snapshot(QueryDesc *queryDesc, bool use_aqo)
+{
+	MemoryContext	oldctx;
+	aqo_obj_stat	ctx = {NIL, NIL, NIL, true, true};
+
+	abort_snapshot_reset();
+
+	/*
+	 * Instrumentation of parallel workers isn't gathered before the error, so
+	 * such plans aren't learned.
+	 */
+	if (!aqo_learn_on_abort || !use_aqo || !query_context.learn_aqo ||
+		query_context.explain_only || queryDesc->planstate == NULL ||
+		queryDesc->plannedstmt->parallelModeNeeded)
+		return;
+
+	if (AQOAbortMemCtx == NULL)
+		AQOAbortMemCtx = AllocSetContextCreate(AQOTopMemCtx,
+											   "AQOAbortLearnMemoryContext",
+											   ALLOCSET_DEFAULT_SIZES);
+
+	oldctx = MemoryContextSwitchTo(AQOAbortMemCtx);
+	(void) abort_snapshot_walker(queryDesc->planstate, &ctx);
+	MemoryContextSwitchTo(oldctx);
+
+	if (abort_snapshot != NIL)
+	{
+		abort_snapshot_owner = queryDesc;
+		abort_snapshot_queryid = query_context.query_hash;
+	}
+}
+
+void
+aqo_xact_callback(XactEvent event, void *arg)
+{
+	/*
+	 * Plan states of the snapshot can't survive the transaction. Captured
+	 * samples wait for the next statement.
+	 */
+	if (!abort_snapshot_captured)
+		abort_snapshot_reset();
+
+	/* Counters of an interrupted planning or learning can't be attributed */
+	if (event == XACT_EVENT_ABORT)
+		aqo_counters_discard();
 }
 
 /*
@@ -713,7 +1517,10 @@ aqo_ExecutorRun(QueryDesc *queryDesc, ScanDirection direction, uint64 count,
 	bool		timeout_enabled = false;
 
 	if (exec_nested_level <= 0)
+	{
+		timeoutCtl.learned = false;
 		timeout_enabled = set_timeout_if_need(queryDesc);
+	}
 
 	Assert(!timeout_enabled ||
 		   (timeoutCtl.queryDesc && timeoutCtl.id >= USER_TIMEOUT));
@@ -727,15 +1534,27 @@ aqo_ExecutorRun(QueryDesc *queryDesc, ScanDirection direction, uint64 count,
 		else
 			standard_ExecutorRun(queryDesc, direction, count, execute_once);
 	}
-	PG_FINALLY();
+	PG_CATCH();
 	{
 		exec_nested_level--;
 		timeoutCtl.queryDesc = NULL;
 
 		if (timeout_enabled)
 			disable_timeout(timeoutCtl.id, false);
+
+		/* Only the top-level statement is learned, as in the timeout case */
+		if (exec_nested_level <= 0)
+			learn_on_abort_capture(queryDesc);
+
+		PG_RE_THROW();
 	}
 	PG_END_TRY();
+
+	exec_nested_level--;
+	timeoutCtl.queryDesc = NULL;
+
+	if (timeout_enabled)
+		disable_timeout(timeoutCtl.id, false);
 }
 
 /*
@@ -753,10 +1572,22 @@ aqo_ExecutorEnd(QueryDesc *queryDesc)
 	EphemeralNamedRelation	enr = get_ENR(queryDesc->queryEnv, PlanStateInfo);
 	MemoryContext oldctx = MemoryContextSwitchTo(AQOLearnMemCtx);
 	double error = .0;
+	uint64		queryid = 0;
+	instr_time	start;
+	AqoLocalCounters saved;
 
+	if (exec_nested_level <= 0)
+		timeout_learn_account();
+
+	aqo_counters_save(&saved);
+	aqo_overhead_start(&start);
 	cardinality_sum_errors = 0.;
 	cardinality_num_objects = 0;
 
+	/* The statement isn't interrupted, its snapshot isn't needed anymore */
+	if (abort_snapshot_owner == queryDesc && !abort_snapshot_captured)
+		abort_snapshot_reset();
+
 	if (IsQueryDisabled() || !ExtractFromQueryEnv(queryDesc))
 		/* AQO keep all query-related preferences at the query context.
 		 * It is needed to prevent from possible recursive changes, at
@@ -766,6 +1597,8 @@ aqo_ExecutorEnd(QueryDesc *queryDesc)
 		 */
 		goto end;
 
+	queryid = query_context.query_hash;
+
 	njoins = (enr != NULL) ? *(int *) enr->reldata : -1;
 
 	Assert(!IsParallelWorker());
@@ -776,15 +1609,49 @@ aqo_ExecutorEnd(QueryDesc *queryDesc)
 		query_context.collect_stat = false;
 	}
 
+	if (aqo_min_execution_time > 0 &&
+		(query_context.learn_aqo || query_context.collect_stat))
+	{
+		INSTR_TIME_SET_CURRENT(endtime);
+		INSTR_TIME_SUBTRACT(endtime, query_context.start_execution_time);
+
+		/*
+		 * Fast execution: skip the learning and update execution counters
+		 * only. If the class has no statistics yet, create it in full.
+		 */
+		if (INSTR_TIME_GET_MICROSEC(endtime) < aqo_min_execution_time &&
+			pg_prng_double(&pg_global_prng_state) >=
+											aqo_fast_execution_sample_rate &&
+			(!query_context.collect_stat ||
+			 aqo_stat_count_execution(query_context.query_hash,
+									  query_context.use_aqo)))
+			goto cleanup;
+	}
+
 	if (query_context.learn_aqo ||
 		(!query_context.learn_aqo && query_context.collect_stat))
 	{
 		aqo_obj_stat ctx = {NIL, NIL, NIL, query_context.learn_aqo, false};
+		instr_time	learn_start;
+
+		/*
+		 * Learn on a random sample of executions of the converged query class.
+		 * The plan is still analyzed to compute the cardinality error and
+		 * detect its drift.
+		 */
+		if (ctx.learn && aqo_learn_rate_min < 1. &&
+			query_context.learn_rate < 1. &&
+			pg_prng_double(&pg_global_prng_state) >= query_context.learn_rate)
+			ctx.learn = false;
 
 		/*
 		 * Analyze plan if AQO need to learn or need to collect statistics only.
 		 */
+		aqo_overhead_start(&learn_start);
+		learn_batch_begin();
 		learnOnPlanState(queryDesc->planstate, (void *) &ctx);
+		learn_batch_apply(false);
+		aqo_overhead_stop(AQO_HOOK_LEARN, &learn_start, true);
 	}
 
 	/* Calculate execution time. */
@@ -797,6 +1664,11 @@ aqo_ExecutorEnd(QueryDesc *queryDesc)
 	else
 		cardinality_error = -1;
 
+	if (query_context.learn_aqo && aqo_learn_rate_min < 1. &&
+		cardinality_error >= 0. && query_context.query_hash != 0)
+		(void) update_query_learn_rate(query_context.query_hash,
+									   cardinality_error);
+
 	if (query_context.collect_stat)
 	{
 		/*
@@ -833,14 +1705,20 @@ aqo_ExecutorEnd(QueryDesc *queryDesc)
 		}
 	}
 
+cleanup:
 	selectivity_cache_clear();
 	cur_classes = ldelete_uint64(cur_classes, query_context.query_hash);
 
 end:
 	/* Release all AQO-specific memory, allocated during learning procedure */
 	MemoryContextSwitchTo(oldctx);
+	aqo_memory_peak(AQO_MEMCTX_LEARN, AQOLearnMemCtx);
 	MemoryContextReset(AQOLearnMemCtx);
 
+	/* Time of the learning above is included into the ExecutorEnd time */
+	aqo_overhead_stop(AQO_HOOK_EXECUTOR_END, &start, true);
+	aqo_counters_restore(&saved, queryid);
+
 	if (prev_ExecutorEnd_hook)
 		prev_ExecutorEnd_hook(queryDesc);
 	else
@@ -975,6 +1853,44 @@ ExtractFromQueryEnv(QueryDesc *queryDesc)
 	return true;
 }
 
+/*
+ * Print how AQO predicted the cardinality of the node. In the text format it
+ * is a separate line, in other formats - properties of the node.
+ */
+static void
+explain_prediction_provenance(ExplainState *es, AQOPlanNode *aqo_node)
+{
+	static const char *source_names[] =
+		{"none", "exact", "wide search", "group model", "fallback"};
+	const char *source = source_names[aqo_node->source];
+
+	if (es->format == EXPLAIN_FORMAT_TEXT)
+	{
+		appendStringInfoChar(es->str, '\n');
+		appendStringInfoSpaces(es->str, es->indent * 2);
+		appendStringInfo(es->str, "AQO source: %s", source);
+		if (aqo_node->model_rows > 0)
+			appendStringInfo(es->str, ", model rows=%d", aqo_node->model_rows);
+		if (aqo_node->nn_distance >= 0.)
+			appendStringInfo(es->str, ", nearest distance=%.3f",
+							 aqo_node->nn_distance);
+		if (aqo_node->predict_time >= 0.)
+			appendStringInfo(es->str, ", time=%.3f ms", aqo_node->predict_time);
+		return;
+	}
+
+	ExplainPropertyText("AQO Source", source, es);
+	if (aqo_node->prediction > 0.)
+		ExplainPropertyFloat("AQO Rows", NULL, aqo_node->prediction, 0, es);
+	ExplainPropertyInteger("AQO Model Rows", NULL, aqo_node->model_rows, es);
+	if (aqo_node->nn_distance >= 0.)
+		ExplainPropertyFloat("AQO Nearest Distance", NULL,
+							 aqo_node->nn_distance, 3, es);
+	if (aqo_node->predict_time >= 0.)
+		ExplainPropertyFloat("AQO Prediction Time", "ms",
+							 aqo_node->predict_time, 3, es);
+}
+
 void
 print_node_explain(ExplainState *es, PlanState *ps, Plan *plan)
 {
@@ -986,12 +1902,19 @@ print_node_explain(ExplainState *es, PlanState *ps, Plan *plan)
 	if (prev_ExplainOneNode_hook)
 		prev_ExplainOneNode_hook(es, ps, plan);
 
-	if (IsQueryDisabled() || !plan || es->format != EXPLAIN_FORMAT_TEXT)
+	if (IsQueryDisabled() || !plan)
 		return;
 
 	if ((aqo_node = get_aqo_plan_node(plan, false)) == NULL)
 		return;
 
+	if (es->format != EXPLAIN_FORMAT_TEXT)
+	{
+		if (aqo_show_provenance)
+			explain_prediction_provenance(es, aqo_node);
+		return;
+	}
+
 	if (!aqo_show_details || !ps)
 		goto explain_end;
 
@@ -1040,6 +1963,9 @@ explain_end:
 	/* XXX: Do we really have situations when the plan is a NULL pointer? */
 	if (plan && aqo_show_hash)
 		appendStringInfo(es->str, ", fss=%d", aqo_node->fss);
+
+	if (aqo_show_provenance)
+		explain_prediction_provenance(es, aqo_node);
 }
 
 /*
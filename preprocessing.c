@@ -63,7 +63,9 @@
 #include "commands/extension.h"
 #include "parser/scansup.h"
 #include "aqo.h"
+#include "counters.h"
 #include "hash.h"
+#include "path_utils.h"
 #include "preprocessing.h"
 #include "storage.h"
 
@@ -71,6 +73,10 @@
 List *cur_classes = NIL;
 
 int aqo_join_threshold = 0;
+double aqo_planning_overhead_limit = 0.;
+
+/* Lower bound of the learning sampling rate. 1 disables the sampling. */
+double aqo_learn_rate_min = 1.;
 
 static bool isQueryUsingSystemRelation(Query *query);
 static bool isQueryUsingSystemRelation_walker(Node *node, void *context);
@@ -127,14 +133,22 @@ aqo_planner(Query *parse,
 {
 	bool			query_is_stored = false;
 	MemoryContext	oldctx;
+	instr_time		start;
+	AqoLocalCounters saved;
+	uint64			queryid;
+
+	/*
+	 * Inside a parallel worker or in parallel mode AQO can predict using the
+	 * knowledge base, but never changes it: learning and statistics are
+	 * collected by the leader only.
+	 */
+	bool			read_only = IsInParallelMode() || IsParallelWorker();
+
+	/* The planning can be nested into planning or execution of another query */
+	aqo_counters_save(&saved);
+	aqo_overhead_start(&start);
 
-	 /*
-	  * We do not work inside an parallel worker now by reason of insert into
-	  * the heap during planning. Transactions are synchronized between parallel
-	  * sections. See GetCurrentCommandId() comments also.
-	  */
 	if (!aqoIsEnabled(parse) ||
-		IsInParallelMode() || IsParallelWorker() ||
 		strstr(application_name, "postgres_fdw") != NULL || /* Prevent distributed deadlocks */
 		strstr(application_name, "pgfdw:") != NULL || /* caused by fdw */
 		isQueryUsingSystemRelation(parse) ||
@@ -145,6 +159,7 @@ aqo_planner(Query *parse,
 		 * all execution stages.
 		 */
 		disable_aqo_for_query();
+		aqo_counters_restore(&saved, 0);
 
 		return call_default_planner(parse,
 									query_string,
@@ -153,6 +168,7 @@ aqo_planner(Query *parse,
 	}
 
 	selectivity_cache_clear();
+	prediction_details_clear();
 
 	/* Check unlucky case (get a hash of zero) */
 	if (parse->queryId == UINT64CONST(0))
@@ -174,6 +190,7 @@ aqo_planner(Query *parse,
 		 * recursion, as an example).
 		 */
 		disable_aqo_for_query();
+		aqo_counters_restore(&saved, 0);
 
 		return call_default_planner(parse,
 									query_string,
@@ -195,6 +212,7 @@ aqo_planner(Query *parse,
 		goto ignore_query_settings;
 	}
 
+	query_context.learn_rate = 1.;
 	query_is_stored = aqo_queries_find(query_context.query_hash, &query_context);
 
 	if (!query_is_stored)
@@ -245,6 +263,8 @@ aqo_planner(Query *parse,
 		}
 		query_context.count_increase_timeout = 0;
 		query_context.smart_timeout = 0;
+		query_context.plan_degradation = AQO_DEGRADE_NONE;
+		query_context.join_limit = 0;
 	}
 	else /* Query class exists in a ML knowledge base. */
 	{
@@ -295,8 +315,21 @@ aqo_planner(Query *parse,
 		}
 	}
 
+	if (read_only)
+	{
+		/*
+		 * Use the knowledge base as the mode says, but don't write into it:
+		 * no new classes, learning, statistics and auto tuning.
+		 */
+		query_context.adding_query = false;
+		query_context.learn_aqo = false;
+		query_context.auto_tuning = false;
+		query_context.collect_stat = false;
+	}
+
 ignore_query_settings:
-	if (!query_is_stored && (query_context.adding_query || force_collect_stat))
+	if (!query_is_stored && !read_only &&
+		(query_context.adding_query || force_collect_stat))
 	{
 		/*
 		 * Add query into the AQO knowledge base. To process an error with
@@ -333,24 +366,39 @@ ignore_query_settings:
 		}
 	}
 
-	if (force_collect_stat)
+	if (force_collect_stat && !read_only)
 		/*
 		 * If this GUC is set, AQO will analyze query results and collect
 		 * query execution statistics in any mode.
 		 */
 		query_context.collect_stat = true;
 
+	INSTR_TIME_SET_ZERO(query_context.predict_time);
+	query_context.max_join_rels = 0;
+
 	if (!IsQueryDisabled())
 		/* It's good place to set timestamp of start of a planning process. */
 		INSTR_TIME_SET_CURRENT(query_context.start_planning_time);
 	{
 		PlannedStmt *stmt;
 
+		aqo_overhead_stop(AQO_HOOK_PLANNER, &start, true);
+
+		/* The query context can be changed by a nested planning */
+		queryid = IsQueryDisabled() ? 0 : query_context.query_hash;
 		stmt = call_default_planner(parse, query_string,
 												 cursorOptions, boundParams);
+		aqo_overhead_start(&start);
+
+		/* Prepare learning data while the selectivity cache is valid */
+		aqo_store_plan_features(stmt);
 
 		/* Release the memory, allocated for AQO predictions */
+		aqo_memory_peak(AQO_MEMCTX_PREDICT, AQOPredictMemCtx);
 		MemoryContextReset(AQOPredictMemCtx);
+		prediction_details_clear();
+		aqo_overhead_stop(AQO_HOOK_PLANNER, &start, false);
+		aqo_counters_restore(&saved, queryid);
 		return stmt;
 	}
 }
@@ -370,6 +418,8 @@ disable_aqo_for_query(void)
 
 	INSTR_TIME_SET_ZERO(query_context.start_planning_time);
 	query_context.planning_time = -1.;
+	query_context.plan_degradation = AQO_DEGRADE_NONE;
+	INSTR_TIME_SET_ZERO(query_context.predict_time);
 }
 
 typedef struct AQOPreWalkerCtx
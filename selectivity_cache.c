@@ -18,17 +18,29 @@
 
 #include "postgres.h"
 
+#include "utils/hsearch.h"
+
 #include "aqo.h"
 
+/*
+ * Selectivities are restored by (clause_hash, global_relid) only, so this pair
+ * is the key of the cache. The first stored selectivity wins: it is what the
+ * former linear scan over the list of cached objects returned.
+ */
 typedef struct
 {
 	int			clause_hash;
-	int			relid;
 	int			global_relid;
+}	EntryKey;
+
+typedef struct
+{
+	EntryKey	key;
+	int			relid;
 	double		selectivity;
 }	Entry;
 
-List	   *objects = NIL;
+static HTAB *objects = NULL;
 
 /* Specific memory context for selectivity objects */
 MemoryContext AQOCacheSelectivity = NULL;
@@ -43,34 +55,40 @@ cache_selectivity(int clause_hash,
 				  int global_relid,
 				  double selectivity)
 {
-	ListCell   *l;
+	EntryKey	key;
 	Entry	   *cur_element;
-	MemoryContext	old_ctx;
+	bool		found;
 
 	if (!AQOCacheSelectivity)
 		AQOCacheSelectivity = AllocSetContextCreate(AQOTopMemCtx,
 													"AQOCacheSelectivity",
 													ALLOCSET_DEFAULT_SIZES);
 
-
-	foreach(l, objects)
+	if (objects == NULL)
 	{
-		cur_element = (Entry *) lfirst(l);
-		if (cur_element->clause_hash == clause_hash &&
-			cur_element->relid == relid &&
-			cur_element->global_relid == global_relid)
-		{
-			return;
-		}
+		HASHCTL		hash_ctl;
+
+		MemSet(&hash_ctl, 0, sizeof(hash_ctl));
+		hash_ctl.keysize = sizeof(EntryKey);
+		hash_ctl.entrysize = sizeof(Entry);
+		hash_ctl.hcxt = AQOCacheSelectivity;
+		objects = hash_create("AQO selectivity cache",
+							  64,		/* start small and extend */
+							  &hash_ctl,
+							  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
 	}
-	old_ctx = MemoryContextSwitchTo(AQOCacheSelectivity);
-	cur_element = palloc(sizeof(*cur_element));
-	cur_element->clause_hash = clause_hash;
+
+	/* Zero the key to avoid garbage in padding bytes, if any */
+	memset(&key, 0, sizeof(key));
+	key.clause_hash = clause_hash;
+	key.global_relid = global_relid;
+
+	cur_element = (Entry *) hash_search(objects, &key, HASH_ENTER, &found);
+	if (found)
+		return;
+
 	cur_element->relid = relid;
-	cur_element->global_relid = global_relid;
 	cur_element->selectivity = selectivity;
-	objects = lappend(objects, cur_element);
-	MemoryContextSwitchTo(old_ctx);
 }
 
 /*
@@ -79,19 +97,21 @@ cache_selectivity(int clause_hash,
 double *
 selectivity_cache_find_global_relid(int clause_hash, int global_relid)
 {
-	ListCell   *l;
+	EntryKey	key;
 	Entry	   *cur_element;
 
-	foreach(l, objects)
-	{
-		cur_element = (Entry *) lfirst(l);
-		if (cur_element->clause_hash == clause_hash &&
-			cur_element->global_relid == global_relid)
-		{
-			return &(cur_element->selectivity);
-		}
-	}
-	return NULL;
+	if (objects == NULL)
+		return NULL;
+
+	memset(&key, 0, sizeof(key));
+	key.clause_hash = clause_hash;
+	key.global_relid = global_relid;
+
+	cur_element = (Entry *) hash_search(objects, &key, HASH_FIND, NULL);
+	if (cur_element == NULL)
+		return NULL;
+
+	return &(cur_element->selectivity);
 }
 
 /*
@@ -102,10 +122,11 @@ selectivity_cache_clear(void)
 {
 	if (!AQOCacheSelectivity)
 	{
-		Assert(objects == NIL);
+		Assert(objects == NULL);
 		return;
 	}
 
+	/* The hash table lives in the context, so just forget about it */
 	MemoryContextReset(AQOCacheSelectivity);
-	objects = NIL;
+	objects = NULL;
 }
@@ -0,0 +1,20 @@
+-- Preliminaries
+CREATE EXTENSION IF NOT EXISTS aqo;
+SELECT true AS success FROM aqo_reset();
+
+CREATE TABLE ovh(x int);
+INSERT INTO ovh (x) (SELECT * FROM generate_series(1, 100) AS gs);
+ANALYZE ovh;
+
+-- Overhead of the AQO hooks
+SET aqo.mode = 'learn';
+SET aqo.track_overhead = 'on';
+SELECT count(*) FROM ovh;
+SET aqo.mode = 'disabled';
+RESET aqo.track_overhead;
+SELECT hook FROM aqo_overhead GROUP BY hook HAVING sum(calls) > 0 ORDER BY hook;
+SELECT aqo_overhead_reset() > 0 AS removed;
+SELECT count(*) FROM aqo_overhead;
+
+DROP TABLE ovh;
+DROP EXTENSION aqo;
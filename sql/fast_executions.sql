@@ -0,0 +1,30 @@
+-- Preliminaries
+CREATE EXTENSION IF NOT EXISTS aqo;
+SELECT true AS success FROM aqo_reset();
+
+CREATE TABLE fe(x int);
+INSERT INTO fe (x) (SELECT * FROM generate_series(1, 100) AS gs);
+ANALYZE fe;
+
+-- Fast executions are only counted
+SET aqo.mode = 'learn';
+SET aqo.min_execution_time = 1000000000;
+SET aqo.fast_execution_sample_rate = 0;
+SELECT count(*) FROM fe;
+SELECT count(*) FROM fe;
+SELECT count(*) FROM fe;
+SET aqo.mode = 'disabled';
+RESET aqo.min_execution_time;
+RESET aqo.fast_execution_sample_rate;
+SELECT executions_with_aqo, array_length(execution_time_with_aqo, 1)
+FROM aqo_query_stat;
+
+-- Streaming aggregates of the execution statistics
+SELECT execution_time_mean_with_aqo > 0 AS mean,
+       execution_time_stddev_with_aqo = 0 AS stddev,
+       array_length(execution_time_quantiles_with_aqo, 1) AS quantiles,
+       execution_time_mean_without_aqo IS NULL AS without_aqo
+FROM aqo_query_stat;
+
+DROP TABLE fe;
+DROP EXTENSION aqo;
@@ -0,0 +1,19 @@
+-- Preliminaries
+CREATE EXTENSION IF NOT EXISTS aqo;
+SELECT true AS success FROM aqo_reset();
+
+CREATE TABLE loa(x int);
+INSERT INTO loa (x) (SELECT * FROM generate_series(1, 100) AS gs);
+ANALYZE loa;
+
+-- Learning on a statement interrupted by an error
+SET aqo.mode = 'learn';
+SET aqo.learn_on_abort = 'on';
+SELECT count(*) FROM loa WHERE x % 2 = 0 AND 1 / (x - 90) > -1;
+SET aqo.mode = 'disabled';
+RESET aqo.learn_on_abort;
+SELECT learned > 0 AS learned FROM aqo_learning_counters();
+SELECT count(*) > 0 AS learned FROM aqo_data;
+
+DROP TABLE loa;
+DROP EXTENSION aqo;
@@ -0,0 +1,21 @@
+-- Preliminaries
+CREATE EXTENSION IF NOT EXISTS aqo;
+SELECT true AS success FROM aqo_reset();
+
+CREATE TABLE lr(x int);
+INSERT INTO lr (x) (SELECT * FROM generate_series(1, 100) AS gs);
+ANALYZE lr;
+
+-- Learning sampling rate decays while the cardinality error doesn't change
+SET aqo.mode = 'learn';
+SET aqo.learn_rate_min = 0.25;
+SELECT count(*) FROM lr;
+SELECT count(*) FROM lr;
+SELECT count(*) FROM lr;
+SELECT count(*) FROM lr;
+SET aqo.mode = 'disabled';
+RESET aqo.learn_rate_min;
+SELECT learn_rate FROM aqo_queries WHERE queryid <> 0;
+
+DROP TABLE lr;
+DROP EXTENSION aqo;
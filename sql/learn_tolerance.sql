@@ -0,0 +1,21 @@
+-- Preliminaries
+CREATE EXTENSION IF NOT EXISTS aqo;
+SELECT true AS success FROM aqo_reset();
+
+CREATE TABLE ltol(x int);
+INSERT INTO ltol (x) (SELECT * FROM generate_series(1, 100) AS gs);
+ANALYZE ltol;
+
+-- Learning skips plan nodes, predicted accurately enough
+SET aqo.mode = 'learn';
+SET aqo.learn_tolerance = 0.1;
+SELECT count(*) FROM ltol;
+SELECT count(*) FROM ltol;
+SELECT count(*) FROM ltol;
+SET aqo.mode = 'disabled';
+RESET aqo.learn_tolerance;
+SELECT learned > 0 AS learned, skipped > 0 AS skipped
+FROM aqo_learning_counters();
+
+DROP TABLE ltol;
+DROP EXTENSION aqo;
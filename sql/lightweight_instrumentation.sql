@@ -0,0 +1,36 @@
+-- Preliminaries
+CREATE EXTENSION IF NOT EXISTS aqo;
+SELECT true AS success FROM aqo_reset();
+
+CREATE TABLE lw AS SELECT gs AS x FROM generate_series(1, 100) AS gs;
+ANALYZE lw;
+
+-- Learn on a fixed workload with the executor instrumentation of rows
+SET aqo.mode = 'learn';
+SELECT count(*) FROM lw t1, lw t2 WHERE t1.x = t2.x AND t2.x < 50;
+SET aqo.mode = 'disabled';
+CREATE TABLE kb_instrument AS SELECT fs, fss, nfeatures, targets FROM aqo_data;
+
+-- The same workload with the row counters of AQO
+SELECT true AS success FROM aqo_reset();
+SET aqo.mode = 'learn';
+SET aqo.lightweight_instrumentation = 'on';
+SELECT count(*) FROM lw t1, lw t2 WHERE t1.x = t2.x AND t2.x < 50;
+SET aqo.mode = 'disabled';
+RESET aqo.lightweight_instrumentation;
+CREATE TABLE kb_counters AS SELECT fs, fss, nfeatures, targets FROM aqo_data;
+
+-- Both ways give exactly the same numbers of rows
+SELECT count(*) = (SELECT count(*) FROM kb_instrument) AS same_count
+FROM kb_counters;
+SELECT count(*) FROM (
+	(TABLE kb_counters EXCEPT TABLE kb_instrument) UNION ALL
+	(TABLE kb_instrument EXCEPT TABLE kb_counters)) AS diff;
+
+-- Rows of the filtered scan and of the join
+SELECT nfeatures, round(exp(t)) AS nrows
+FROM kb_counters, unnest(targets) AS t
+WHERE nfeatures > 0 ORDER BY nfeatures;
+
+DROP TABLE lw, kb_instrument, kb_counters;
+DROP EXTENSION aqo;
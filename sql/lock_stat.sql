@@ -0,0 +1,20 @@
+-- Preliminaries
+CREATE EXTENSION IF NOT EXISTS aqo;
+SELECT true AS success FROM aqo_reset();
+
+CREATE TABLE lst(x int);
+INSERT INTO lst (x) (SELECT * FROM generate_series(1, 100) AS gs);
+ANALYZE lst;
+
+-- Acquisitions of the AQO locks and memory of the storage
+SELECT aqo_lock_stat_reset() > 0 AS reset;
+SET aqo.mode = 'learn';
+SELECT count(*) FROM lst WHERE x < 10;
+SET aqo.mode = 'disabled';
+SELECT lock, acquisitions > 0 AS acquired, contended <= acquisitions AS contended
+FROM aqo_lock_stat() WHERE lock IN ('stat', 'data', 'queries') ORDER BY lock;
+SELECT area, allocations > 0 AS allocated, used_bytes > 0 AS used
+FROM aqo_dsa_stat() WHERE area = 'data';
+
+DROP TABLE lst;
+DROP EXTENSION aqo;
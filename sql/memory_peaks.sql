@@ -0,0 +1,21 @@
+-- Preliminaries
+CREATE EXTENSION IF NOT EXISTS aqo;
+SELECT true AS success FROM aqo_reset();
+
+CREATE TABLE mp(x int);
+INSERT INTO mp (x) (SELECT * FROM generate_series(1, 100) AS gs);
+ANALYZE mp;
+
+-- Peak sizes of the AQO memory contexts
+SELECT true AS success FROM aqo_memory_peaks_reset();
+SET aqo.mode = 'learn';
+SET aqo.track_overhead = 'on';
+SELECT count(*) FROM mp WHERE x < 10;
+SET aqo.mode = 'disabled';
+RESET aqo.track_overhead;
+SELECT name, peak_size > 0 AS tracked FROM aqo_memory_peaks() ORDER BY name;
+SELECT aqo_memory_peaks_reset() AS reset;
+SELECT sum(peak_size) FROM aqo_memory_peaks();
+
+DROP TABLE mp;
+DROP EXTENSION aqo;
@@ -0,0 +1,29 @@
+-- Preliminaries
+CREATE EXTENSION IF NOT EXISTS aqo;
+SELECT true AS success FROM aqo_reset();
+
+CREATE TABLE po(x int);
+INSERT INTO po (x) (SELECT * FROM generate_series(1, 100) AS gs);
+ANALYZE po;
+
+-- Check the planning overhead budget: tiny limit is exceeded by any planning.
+-- Each step of the degradation needs three samples over the limit in a row.
+SET aqo.mode = 'learn';
+SET aqo.planning_overhead_limit = 0.000001;
+SELECT count(*) FROM po t1, po t2, po t3 WHERE t1.x = t2.x AND t2.x = t3.x;
+SELECT count(*) FROM po t1, po t2, po t3 WHERE t1.x = t2.x AND t2.x = t3.x;
+SELECT count(*) FROM po t1, po t2, po t3 WHERE t1.x = t2.x AND t2.x = t3.x;
+SELECT count(*) FROM po t1, po t2, po t3 WHERE t1.x = t2.x AND t2.x = t3.x;
+SELECT count(*) FROM po t1, po t2, po t3 WHERE t1.x = t2.x AND t2.x = t3.x;
+SELECT count(*) FROM po t1, po t2, po t3 WHERE t1.x = t2.x AND t2.x = t3.x;
+SELECT count(*) FROM po t1, po t2, po t3 WHERE t1.x = t2.x AND t2.x = t3.x;
+SELECT count(*) FROM po t1, po t2, po t3 WHERE t1.x = t2.x AND t2.x = t3.x;
+SELECT count(*) FROM po t1, po t2, po t3 WHERE t1.x = t2.x AND t2.x = t3.x;
+SET aqo.mode = 'disabled';
+RESET aqo.planning_overhead_limit;
+
+-- Predictions are degraded step by step up to the limit of joins size
+SELECT plan_degradation, join_limit FROM aqo_queries WHERE queryid <> 0;
+
+DROP TABLE po;
+DROP EXTENSION aqo;
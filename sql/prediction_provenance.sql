@@ -0,0 +1,34 @@
+-- Preliminaries
+CREATE EXTENSION IF NOT EXISTS aqo;
+SELECT true AS success FROM aqo_reset();
+
+-- Utility tool. Allow to filter system-dependent strings from an explain output.
+CREATE OR REPLACE FUNCTION expln(query_string text) RETURNS SETOF text AS $$
+BEGIN
+    RETURN QUERY
+        EXECUTE format('%s', query_string);
+    RETURN;
+END;
+$$ LANGUAGE PLPGSQL;
+
+CREATE TABLE prov(x int);
+INSERT INTO prov (x) (SELECT * FROM generate_series(1, 100) AS gs);
+ANALYZE prov;
+
+-- Provenance of the predictions on explain
+SET aqo.mode = 'learn';
+SELECT count(*) FROM prov WHERE x < 10;
+SET aqo.show_provenance = 'on';
+SELECT p->>'Node Type' AS node, p->>'AQO Source' AS source,
+       p->>'AQO Model Rows' AS model_rows,
+       p->>'AQO Nearest Distance' AS distance,
+       (p->>'AQO Prediction Time')::float8 >= 0 AS timed
+FROM (SELECT str::jsonb->0->'Plan'->'Plans'->0 AS p FROM expln('
+  EXPLAIN (COSTS OFF, FORMAT JSON)
+    SELECT count(*) FROM prov WHERE x < 10') AS str) AS q;
+SET aqo.mode = 'disabled';
+RESET aqo.show_provenance;
+
+DROP TABLE prov;
+DROP FUNCTION expln;
+DROP EXTENSION aqo;
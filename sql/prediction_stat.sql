@@ -0,0 +1,25 @@
+-- Preliminaries
+CREATE EXTENSION IF NOT EXISTS aqo;
+SELECT true AS success FROM aqo_reset();
+
+CREATE TABLE pst(x int);
+INSERT INTO pst (x) (SELECT * FROM generate_series(1, 100) AS gs);
+ANALYZE pst;
+
+-- Outcomes of cardinality predictions
+SET aqo.track_overhead = 'on';
+SET aqo.mode = 'learn';
+SELECT count(*) FROM pst WHERE x < 10;
+SELECT count(*) FROM pst WHERE x < 10;
+SET aqo.mode = 'disabled';
+RESET aqo.track_overhead;
+SELECT exact > 0 AS exact, wide, few_neighbors, misses > 0 AS misses,
+       hit_rate > 0 AND hit_rate < 1 AS hit_rate, wide_scans
+FROM aqo_prediction_stat;
+SELECT exact > 0 AS exact, misses > 0 AS misses FROM aqo_prediction_counters();
+SELECT aqo_prediction_stat_reset() > 0 AS removed;
+SELECT count(*) FROM aqo_prediction_stat;
+SELECT exact, misses, hit_rate FROM aqo_prediction_counters();
+
+DROP TABLE pst;
+DROP EXTENSION aqo;
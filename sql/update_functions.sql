@@ -59,7 +59,15 @@ SET aqo.mode='controlled';
 
 CREATE TABLE aqo_query_texts_dump AS SELECT * FROM aqo_query_texts;
 CREATE TABLE aqo_queries_dump AS SELECT * FROM aqo_queries;
-CREATE TABLE aqo_query_stat_dump AS SELECT * FROM aqo_query_stat;
+-- The streaming aggregates of the statistics are rebuilt by the last samples
+-- only. Compare the samples and the execution counters.
+CREATE VIEW aqo_query_stat_samples AS
+SELECT queryid, execution_time_with_aqo, execution_time_without_aqo,
+       planning_time_with_aqo, planning_time_without_aqo,
+       cardinality_error_with_aqo, cardinality_error_without_aqo,
+       executions_with_aqo, executions_without_aqo
+FROM aqo_query_stat;
+CREATE TABLE aqo_query_stat_dump AS SELECT * FROM aqo_query_stat_samples;
 CREATE TABLE aqo_data_dump AS SELECT * FROM aqo_data;
 
 SELECT true AS success FROM aqo_reset();
@@ -125,9 +133,9 @@ FROM aqo_query_stat_dump
 ORDER BY res;
 
 -- Check if data is the same as in source, no result rows expected.
-(TABLE aqo_query_stat_dump EXCEPT TABLE aqo_query_stat)
+(TABLE aqo_query_stat_dump EXCEPT TABLE aqo_query_stat_samples)
 UNION ALL
-(TABLE aqo_query_stat EXCEPT TABLE aqo_query_stat_dump);
+(TABLE aqo_query_stat_samples EXCEPT TABLE aqo_query_stat_dump);
 
 -- Update aqo_query_stat with dump data.
 SELECT aqo_query_stat_update(queryid, execution_time_with_aqo,
@@ -138,9 +146,9 @@ FROM aqo_query_stat_dump
 ORDER BY res;
 
 -- Check if data is the same as in source, no result rows expected.
-(TABLE aqo_query_stat_dump EXCEPT TABLE aqo_query_stat)
+(TABLE aqo_query_stat_dump EXCEPT TABLE aqo_query_stat_samples)
 UNION ALL
-(TABLE aqo_query_stat EXCEPT TABLE aqo_query_stat_dump);
+(TABLE aqo_query_stat_samples EXCEPT TABLE aqo_query_stat_dump);
 
 --
 -- aqo_data_update() testing.
@@ -204,6 +212,7 @@ SELECT aqo_data_update(1, 1, 1, '{{1}, {2}}', '{1}', '{1}', '{1, 2, 3}');
 
 SET aqo.mode='disabled';
 
+DROP VIEW aqo_query_stat_samples;
 DROP EXTENSION aqo CASCADE;
 
 DROP TABLE aqo_test1, aqo_test2;
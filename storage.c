@@ -25,6 +25,8 @@
 
 #include "aqo.h"
 #include "aqo_shared.h"
+#include "aqo_trace.h"
+#include "counters.h"
 #include "machine_learning.h"
 #include "preprocessing.h"
 #include "storage.h"
@@ -42,9 +44,15 @@
 
 typedef enum {
 	QUERYID = 0, EXEC_TIME_AQO, EXEC_TIME, PLAN_TIME_AQO, PLAN_TIME,
-	EST_ERROR_AQO, EST_ERROR, NEXECS_AQO, NEXECS, TOTAL_NCOLS
+	EST_ERROR_AQO, EST_ERROR, NEXECS_AQO, NEXECS,
+	EXEC_TIME_MEAN_AQO, EXEC_TIME_STDDEV_AQO, EXEC_TIME_QUANTILES_AQO,
+	EXEC_TIME_MEAN, EXEC_TIME_STDDEV, EXEC_TIME_QUANTILES,
+	EST_ERROR_MEAN_AQO, EST_ERROR_MEAN, TOTAL_NCOLS
 } aqo_stat_cols;
 
+/* Quantiles of execution time, shown by the aqo_query_stat view */
+static const double exec_time_quantiles[] = {0.5, 0.95, 0.99};
+
 typedef enum {
 	QT_QUERYID = 0, QT_QUERY_STRING, QT_TOTAL_NCOLS
 } aqo_qtexts_cols;
@@ -56,9 +64,29 @@ typedef enum {
 
 typedef enum {
 	AQ_QUERYID = 0, AQ_FS, AQ_LEARN_AQO, AQ_USE_AQO, AQ_AUTO_TUNING, AQ_SMART_TIMEOUT, AQ_COUNT_INCREASE_TIMEOUT,
+	AQ_PLAN_OVERHEAD, AQ_PLAN_DEGRADATION, AQ_JOIN_LIMIT, AQ_LEARN_RATE,
 	AQ_TOTAL_NCOLS
 } aqo_queries_cols;
 
+/*
+ * Planning overhead budget: weight of a new observation in the smoothed
+ * overhead, number of consecutive samples over the budget to degrade the
+ * prediction by one step (or well below it to restore one step) and share of
+ * the budget, considered as well below it.
+ */
+#define PLAN_OVERHEAD_SMOOTHING	(0.3)
+#define PLAN_OVERHEAD_SAMPLES	(3)
+#define PLAN_OVERHEAD_RECOVERY	(0.5)
+
+/*
+ * Learning sampling: weight of a new observation in the smoothed cardinality
+ * error, max change of the error (in terms of log of cardinality), considered
+ * as a converged state, and the rate decay factor for this state.
+ */
+#define LEARN_RATE_SMOOTHING	(0.3)
+#define LEARN_RATE_DRIFT		(0.05)
+#define LEARN_RATE_DECAY		(0.5)
+
 typedef void* (*form_record_t) (void *ctx, size_t *size);
 typedef bool (*deform_record_t) (void *data, size_t size);
 
@@ -91,6 +119,9 @@ static int data_store(const char *filename, form_record_t callback,
 					  long nrecs, void *ctx);
 static void data_load(const char *filename, deform_record_t callback, void *ctx);
 static size_t _compute_data_dsa(const DataEntry *entry);
+static size_t _compute_qtext_dsa(const QueryTextEntry *entry);
+static dsa_pointer _dsa_allocate(AqoDsaArea area, size_t size, bool zero);
+static void _dsa_free(AqoDsaArea area, dsa_pointer dp, size_t size);
 
 static bool _aqo_stat_remove(uint64 queryid);
 static bool _aqo_queries_remove(uint64 queryid);
@@ -114,6 +145,7 @@ PG_FUNCTION_INFO_V1(aqo_execution_time);
 PG_FUNCTION_INFO_V1(aqo_query_texts_update);
 PG_FUNCTION_INFO_V1(aqo_query_stat_update);
 PG_FUNCTION_INFO_V1(aqo_data_update);
+PG_FUNCTION_INFO_V1(aqo_learning_counters);
 
 
 bool
@@ -185,6 +217,22 @@ form_vector(double *vector, int nrows)
 	return array;
 }
 
+/*
+ * Forms ArrayType object from the unrolled ring buffer of a stat entry.
+ */
+static ArrayType *
+form_stat_vector(float4 *ring, int nvalues)
+{
+	double	values[STAT_SAMPLE_SIZE];
+	int		i;
+
+	Assert(nvalues <= STAT_SAMPLE_SIZE);
+
+	for (i = 0; i < nvalues; i++)
+		values[i] = ring[i];
+	return form_vector(values, nvalues);
+}
+
 /* Creates a storage for hashes of deactivated queries */
 void
 init_deactivated_queries_storage(void)
@@ -232,6 +280,272 @@ reset_deactivated_queries(void)
 	}
 }
 
+/*
+ * Rotate the ring buffer so that its oldest value becomes the first one.
+ */
+static void
+stat_ring_unroll(float4 *ring, int first)
+{
+	float4	tmp[STAT_SAMPLE_SIZE];
+
+	memcpy(tmp, &ring[first], (STAT_SAMPLE_SIZE - first) * sizeof(float4));
+	memcpy(&tmp[STAT_SAMPLE_SIZE - first], ring, first * sizeof(float4));
+	memcpy(ring, tmp, sizeof(tmp));
+}
+
+/*
+ * Put the values of the ring buffers of a copy of the stat entry in the
+ * chronological order.
+ */
+static void
+stat_entry_unroll(StatEntry *entry)
+{
+	if (entry->first_stat_slot > 0)
+	{
+		stat_ring_unroll(entry->exec_time, entry->first_stat_slot);
+		stat_ring_unroll(entry->plan_time, entry->first_stat_slot);
+		stat_ring_unroll(entry->est_error, entry->first_stat_slot);
+		entry->first_stat_slot = 0;
+	}
+
+	if (entry->first_stat_slot_aqo > 0)
+	{
+		stat_ring_unroll(entry->exec_time_aqo, entry->first_stat_slot_aqo);
+		stat_ring_unroll(entry->plan_time_aqo, entry->first_stat_slot_aqo);
+		stat_ring_unroll(entry->est_error_aqo, entry->first_stat_slot_aqo);
+		entry->first_stat_slot_aqo = 0;
+	}
+}
+
+/*
+ * Copy the stat entry without blocking of concurrent updates of other entries.
+ * Caller must hold the stat_lock.
+ */
+static void
+stat_entry_copy(StatEntry *dst, StatHashEntry *src)
+{
+	Assert(LWLockHeldByMe(&aqo_state->stat_lock));
+
+	SpinLockAcquire(&src->mutex);
+	memcpy(dst, &src->stat, sizeof(StatEntry));
+	SpinLockRelease(&src->mutex);
+
+	stat_entry_unroll(dst);
+}
+
+static void
+stat_ewma_add(StatEWMA *ewma, double value)
+{
+	if (ewma->n == 0)
+	{
+		ewma->mean = value;
+		ewma->var = 0.;
+	}
+	else
+	{
+		double	diff = value - ewma->mean;
+		double	incr = STAT_EWMA_WEIGHT * diff;
+
+		ewma->mean += incr;
+		ewma->var = (1. - STAT_EWMA_WEIGHT) * (ewma->var + diff * incr);
+	}
+
+	ewma->n++;
+}
+
+/*
+ * Bucket of the sketch for the execution time. Computed before the entry is
+ * locked.
+ */
+static int
+stat_sketch_bucket(double time)
+{
+	double	us = time * 1000000.;
+	int		idx;
+
+	idx = (us < 1.) ? 0 : (int) (2. * log2(us));
+	return Min(idx, STAT_SKETCH_NBUCKETS - 1);
+}
+
+static void
+stat_sketch_add(StatSketch *sketch, int idx)
+{
+	Assert(idx >= 0 && idx < STAT_SKETCH_NBUCKETS);
+
+	if (sketch->counts[idx] == PG_UINT16_MAX)
+	{
+		int i;
+
+		for (i = 0; i < STAT_SKETCH_NBUCKETS; i++)
+			sketch->counts[i] >>= 1;
+	}
+
+	sketch->counts[idx]++;
+}
+
+/*
+ * Estimate the q-quantile of execution time in seconds.
+ * Returns a negative value, if the sketch is empty.
+ */
+double
+stat_sketch_quantile(StatSketch *sketch, double q)
+{
+	uint64	total = 0;
+	uint64	cum = 0;
+	int		i;
+
+	for (i = 0; i < STAT_SKETCH_NBUCKETS; i++)
+		total += sketch->counts[i];
+
+	if (total == 0)
+		return -1.;
+
+	for (i = 0; i < STAT_SKETCH_NBUCKETS - 1; i++)
+	{
+		cum += sketch->counts[i];
+		if (cum >= q * total)
+			break;
+	}
+
+	/* The middle of the bucket in the logarithmic scale */
+	return pow(2., (i + 0.5) / 2.) / 1000000.;
+}
+
+/*
+ * Add one execution into the streaming aggregates. Negative values mean
+ * unknown planning time or cardinality error and are skipped.
+ */
+static void
+stat_entry_aggregate(StatEntry *entry, bool use_aqo, double exec_time,
+					 double plan_time, double est_error, int bucket)
+{
+	if (use_aqo)
+	{
+		stat_ewma_add(&entry->exec_time_avg_aqo, exec_time);
+		stat_sketch_add(&entry->exec_time_sketch_aqo, bucket);
+		if (plan_time >= 0.)
+			stat_ewma_add(&entry->plan_time_avg_aqo, plan_time);
+		if (est_error >= 0.)
+			stat_ewma_add(&entry->est_error_avg_aqo, est_error);
+	}
+	else
+	{
+		stat_ewma_add(&entry->exec_time_avg, exec_time);
+		stat_sketch_add(&entry->exec_time_sketch, bucket);
+		if (plan_time >= 0.)
+			stat_ewma_add(&entry->plan_time_avg, plan_time);
+		if (est_error >= 0.)
+			stat_ewma_add(&entry->est_error_avg, est_error);
+	}
+}
+
+/*
+ * Build the streaming aggregates from scratch by the ring buffers of the entry.
+ * Used if the entry is loaded or updated from outside.
+ */
+static void
+stat_entry_rebuild_aggregates(StatEntry *entry)
+{
+	int		i;
+	int		pos;
+
+	memset(&entry->exec_time_avg, 0,
+		   sizeof(StatEntry) - offsetof(StatEntry, exec_time_avg));
+
+	for (i = 0; i < entry->cur_stat_slot; i++)
+	{
+		pos = (entry->first_stat_slot + i) % STAT_SAMPLE_SIZE;
+		stat_entry_aggregate(entry, false, entry->exec_time[pos],
+							 entry->plan_time[pos], entry->est_error[pos],
+							 stat_sketch_bucket(entry->exec_time[pos]));
+	}
+	for (i = 0; i < entry->cur_stat_slot_aqo; i++)
+	{
+		pos = (entry->first_stat_slot_aqo + i) % STAT_SAMPLE_SIZE;
+		stat_entry_aggregate(entry, true, entry->exec_time_aqo[pos],
+							 entry->plan_time_aqo[pos],
+							 entry->est_error_aqo[pos],
+							 stat_sketch_bucket(entry->exec_time_aqo[pos]));
+	}
+}
+
+/*
+ * Slot of the ring buffer for a new value. If the buffer is full, the oldest
+ * value is replaced.
+ */
+static int
+stat_ring_next(int *nvalues, int *first)
+{
+	int		pos;
+
+	Assert(*nvalues >= 0 && *nvalues <= STAT_SAMPLE_SIZE);
+
+	if (*nvalues < STAT_SAMPLE_SIZE)
+	{
+		Assert(*first == 0);
+		return (*nvalues)++;
+	}
+
+	pos = *first;
+	*first = (pos + 1) % STAT_SAMPLE_SIZE;
+	return pos;
+}
+
+/*
+ * Append the execution data to the stat entry. Caller must hold the stat_lock
+ * exclusively or the entry mutex, so it is O(1) and doesn't call any math
+ * functions: the bucket of the sketch is computed by the caller beforehand.
+ *
+ * The aggregates are fed by the values as they are stored in the ring buffers,
+ * so stat_entry_rebuild_aggregates() gives the same result for the same values.
+ */
+static void
+stat_entry_append(StatEntry *entry, bool use_aqo, AqoStatArgs *stat_arg,
+				  int bucket)
+{
+	int		pos;
+
+	if (use_aqo)
+	{
+		pos = stat_ring_next(&entry->cur_stat_slot_aqo,
+							 &entry->first_stat_slot_aqo);
+
+		entry->execs_with_aqo++;
+		entry->plan_time_aqo[pos] = *stat_arg->plan_time_aqo;
+		entry->exec_time_aqo[pos] = *stat_arg->exec_time_aqo;
+		entry->est_error_aqo[pos] = *stat_arg->est_error_aqo;
+		stat_entry_aggregate(entry, true, entry->exec_time_aqo[pos],
+							 entry->plan_time_aqo[pos],
+							 entry->est_error_aqo[pos], bucket);
+	}
+	else
+	{
+		pos = stat_ring_next(&entry->cur_stat_slot, &entry->first_stat_slot);
+
+		entry->execs_without_aqo++;
+		entry->plan_time[pos] = *stat_arg->plan_time;
+		entry->exec_time[pos] = *stat_arg->exec_time;
+		entry->est_error[pos] = *stat_arg->est_error;
+		stat_entry_aggregate(entry, false, entry->exec_time[pos],
+							 entry->plan_time[pos], entry->est_error[pos],
+							 bucket);
+	}
+}
+
+/*
+ * Fill the ring buffer by an array of values, passed from outside.
+ */
+static void
+stat_ring_fill(float4 *ring, double *values, int nvalues)
+{
+	int		i;
+
+	Assert(nvalues <= STAT_SAMPLE_SIZE);
+
+	for (i = 0; i < nvalues; i++)
+		ring[i] = (float4) values[i];
+}
+
 /*
  * Update AQO statistics.
  *
@@ -239,29 +553,57 @@ reset_deactivated_queries(void)
  * Returns a copy of stat entry, allocated in current memory context. Caller is
  * in charge to free this struct after usage.
  * If stat hash table is full, return NULL and log this fact.
+ *
+ * Existed entry is updated in append mode under the shared stat_lock and the
+ * entry mutex, so executions of different query classes don't block each
+ * other. The exclusive lock is needed to add or to rewrite an entry only.
  */
 StatEntry *
 aqo_stat_store(uint64 queryid, bool use_aqo, AqoStatArgs *stat_arg,
 			   bool append_mode)
 {
-	StatEntry  *entry;
-	bool		found;
-	int			pos;
-	bool		tblOverflow;
-	HASHACTION	action;
+	StatHashEntry  *hentry;
+	StatEntry	   *entry;
+	StatEntry	   *result = palloc(sizeof(StatEntry));
+	bool			found;
+	bool			tblOverflow;
+	HASHACTION		action;
+	int				bucket = 0;
 
 	Assert(stat_htab);
 
-	LWLockAcquire(&aqo_state->stat_lock, LW_EXCLUSIVE);
+	if (append_mode)
+	{
+		bucket = stat_sketch_bucket((float4) (use_aqo ?
+												*stat_arg->exec_time_aqo :
+												*stat_arg->exec_time));
+
+		aqo_lwlock_acquire(&aqo_state->stat_lock, LW_SHARED);
+		hentry = (StatHashEntry *) hash_search(stat_htab, &queryid, HASH_FIND,
+											   &found);
+		if (found)
+		{
+			SpinLockAcquire(&hentry->mutex);
+			stat_entry_append(&hentry->stat, use_aqo, stat_arg, bucket);
+			memcpy(result, &hentry->stat, sizeof(StatEntry));
+			SpinLockRelease(&hentry->mutex);
+
+			aqo_state->stat_changed = true;
+			LWLockRelease(&aqo_state->stat_lock);
+			stat_entry_unroll(result);
+			return result;
+		}
+		LWLockRelease(&aqo_state->stat_lock);
+	}
+
+	aqo_lwlock_acquire(&aqo_state->stat_lock, LW_EXCLUSIVE);
 	tblOverflow = hash_get_num_entries(stat_htab) < fs_max_items ? false : true;
 	action = tblOverflow ? HASH_FIND : HASH_ENTER;
-	entry = (StatEntry *) hash_search(stat_htab, &queryid, action, &found);
+	hentry = (StatHashEntry *) hash_search(stat_htab, &queryid, action, &found);
 
 	/* Initialize entry on first usage */
 	if (!found)
 	{
-		uint64 qid;
-
 		if (action == HASH_FIND)
 		{
 			/*
@@ -269,6 +611,7 @@ aqo_stat_store(uint64 queryid, bool use_aqo, AqoStatArgs *stat_arg,
 			 * more, just exit
 			 */
 			LWLockRelease(&aqo_state->stat_lock);
+			pfree(result);
 			ereport(LOG,
 				(errcode(ERRCODE_OUT_OF_MEMORY),
 				 errmsg("[AQO] Stat storage is full. No more feature spaces can be added."),
@@ -276,88 +619,117 @@ aqo_stat_store(uint64 queryid, bool use_aqo, AqoStatArgs *stat_arg,
 			return NULL;
 		}
 
-		qid = entry->queryid;
-		memset(entry, 0, sizeof(StatEntry));
-		entry->queryid = qid;
+		memset(&hentry->stat, 0, sizeof(StatEntry));
+		hentry->stat.queryid = queryid;
+		SpinLockInit(&hentry->mutex);
 	}
 
+	/* Nobody else can access the entry under the exclusive lock */
+	entry = &hentry->stat;
+
 	if (!append_mode)
 	{
-		size_t sz;
 		if (found)
 		{
 			memset(entry, 0, sizeof(StatEntry));
 			entry->queryid = queryid;
 		}
 
-		sz = stat_arg->cur_stat_slot_aqo * sizeof(entry->est_error_aqo[0]);
-		memcpy(entry->plan_time_aqo, stat_arg->plan_time_aqo, sz);
-		memcpy(entry->exec_time_aqo, stat_arg->exec_time_aqo, sz);
-		memcpy(entry->est_error_aqo, stat_arg->est_error_aqo, sz);
+		stat_ring_fill(entry->plan_time_aqo, stat_arg->plan_time_aqo,
+					   stat_arg->cur_stat_slot_aqo);
+		stat_ring_fill(entry->exec_time_aqo, stat_arg->exec_time_aqo,
+					   stat_arg->cur_stat_slot_aqo);
+		stat_ring_fill(entry->est_error_aqo, stat_arg->est_error_aqo,
+					   stat_arg->cur_stat_slot_aqo);
 		entry->execs_with_aqo = stat_arg->execs_with_aqo;
 		entry->cur_stat_slot_aqo = stat_arg->cur_stat_slot_aqo;
 
-		sz = stat_arg->cur_stat_slot * sizeof(entry->est_error[0]);
-		memcpy(entry->plan_time, stat_arg->plan_time, sz);
-		memcpy(entry->exec_time, stat_arg->exec_time, sz);
-		memcpy(entry->est_error, stat_arg->est_error, sz);
+		stat_ring_fill(entry->plan_time, stat_arg->plan_time,
+					   stat_arg->cur_stat_slot);
+		stat_ring_fill(entry->exec_time, stat_arg->exec_time,
+					   stat_arg->cur_stat_slot);
+		stat_ring_fill(entry->est_error, stat_arg->est_error,
+					   stat_arg->cur_stat_slot);
 		entry->execs_without_aqo = stat_arg->execs_without_aqo;
 		entry->cur_stat_slot = stat_arg->cur_stat_slot;
+		stat_entry_rebuild_aggregates(entry);
 
 		aqo_state->stat_changed = true;
 		LWLockRelease(&aqo_state->stat_lock);
+		pfree(result);
 		return entry;
 	}
 
 	/* Update the entry data */
+	stat_entry_append(entry, use_aqo, stat_arg, bucket);
 
-	if (use_aqo)
+	memcpy(result, entry, sizeof(StatEntry));
+	aqo_state->stat_changed = true;
+	LWLockRelease(&aqo_state->stat_lock);
+	stat_entry_unroll(result);
+	return result;
+}
+
+/*
+ * Count an execution of the query class without adding its times and errors
+ * into the stat entry. Doesn't add new entries.
+ *
+ * Returns false if the class has no stat entry yet.
+ */
+bool
+aqo_stat_count_execution(uint64 queryid, bool use_aqo)
+{
+	StatHashEntry  *hentry;
+	bool			found;
+
+	Assert(stat_htab);
+
+	aqo_lwlock_acquire(&aqo_state->stat_lock, LW_SHARED);
+	hentry = (StatHashEntry *) hash_search(stat_htab, &queryid, HASH_FIND,
+										   &found);
+	if (found)
 	{
-		Assert(entry->cur_stat_slot_aqo >= 0);
-		pos = entry->cur_stat_slot_aqo;
-		if (entry->cur_stat_slot_aqo < STAT_SAMPLE_SIZE - 1)
-			entry->cur_stat_slot_aqo++;
+		SpinLockAcquire(&hentry->mutex);
+		if (use_aqo)
+			hentry->stat.execs_with_aqo++;
 		else
-		{
-			size_t sz = (STAT_SAMPLE_SIZE - 1) * sizeof(entry->est_error_aqo[0]);
-
-			Assert(entry->cur_stat_slot_aqo = STAT_SAMPLE_SIZE - 1);
-			memmove(entry->plan_time_aqo, &entry->plan_time_aqo[1], sz);
-			memmove(entry->exec_time_aqo, &entry->exec_time_aqo[1], sz);
-			memmove(entry->est_error_aqo, &entry->est_error_aqo[1], sz);
-		}
+			hentry->stat.execs_without_aqo++;
+		SpinLockRelease(&hentry->mutex);
 
-		entry->execs_with_aqo++;
-		entry->plan_time_aqo[pos] = *stat_arg->plan_time_aqo;
-		entry->exec_time_aqo[pos] = *stat_arg->exec_time_aqo;
-		entry->est_error_aqo[pos] = *stat_arg->est_error_aqo;
+		aqo_state->stat_changed = true;
 	}
-	else
+	LWLockRelease(&aqo_state->stat_lock);
+	return found;
+}
+
+/*
+ * Fill output columns of streaming aggregates. Unknown values are NULL.
+ */
+static void
+form_stat_aggregates(Datum *values, bool *nulls, int mean_col, int stddev_col,
+					 int quantiles_col, int error_col, StatEWMA *exec_time,
+					 StatSketch *sketch, StatEWMA *est_error)
+{
+	if (exec_time->n > 0)
 	{
-		Assert(entry->cur_stat_slot >= 0);
-		pos = entry->cur_stat_slot;
-		if (entry->cur_stat_slot < STAT_SAMPLE_SIZE - 1)
-			entry->cur_stat_slot++;
-		else
-		{
-			size_t sz = (STAT_SAMPLE_SIZE - 1) * sizeof(entry->est_error[0]);
+		double	quantiles[lengthof(exec_time_quantiles)];
+		int		i;
 
-			Assert(entry->cur_stat_slot = STAT_SAMPLE_SIZE - 1);
-			memmove(entry->plan_time, &entry->plan_time[1], sz);
-			memmove(entry->exec_time, &entry->exec_time[1], sz);
-			memmove(entry->est_error, &entry->est_error[1], sz);
-		}
+		for (i = 0; i < lengthof(exec_time_quantiles); i++)
+			quantiles[i] = stat_sketch_quantile(sketch, exec_time_quantiles[i]);
 
-		entry->execs_without_aqo++;
-		entry->plan_time[pos] = *stat_arg->plan_time;
-		entry->exec_time[pos] = *stat_arg->exec_time;
-		entry->est_error[pos] = *stat_arg->est_error;
+		values[mean_col] = Float8GetDatum(exec_time->mean);
+		values[stddev_col] = Float8GetDatum(sqrt(exec_time->var));
+		values[quantiles_col] =
+			PointerGetDatum(form_vector(quantiles, lengthof(quantiles)));
 	}
+	else
+		nulls[mean_col] = nulls[stddev_col] = nulls[quantiles_col] = true;
 
-	entry = memcpy(palloc(sizeof(StatEntry)), entry, sizeof(StatEntry));
-	aqo_state->stat_changed = true;
-	LWLockRelease(&aqo_state->stat_lock);
-	return entry;
+	if (est_error->n > 0)
+		values[error_col] = Float8GetDatum(est_error->mean);
+	else
+		nulls[error_col] = true;
 }
 
 /*
@@ -374,7 +746,9 @@ aqo_query_stat(PG_FUNCTION_ARGS)
 	Datum				values[TOTAL_NCOLS + 1];
 	bool				nulls[TOTAL_NCOLS + 1];
 	HASH_SEQ_STATUS		hash_seq;
-	StatEntry	   *entry;
+	StatHashEntry  *hentry;
+	StatEntry		entry_copy;
+	StatEntry	   *entry = &entry_copy;
 
 	/* check to see if caller supports us returning a tuplestore */
 	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
@@ -403,21 +777,31 @@ aqo_query_stat(PG_FUNCTION_ARGS)
 	MemoryContextSwitchTo(oldcontext);
 
 	memset(nulls, 0, TOTAL_NCOLS + 1);
-	LWLockAcquire(&aqo_state->stat_lock, LW_SHARED);
+	aqo_lwlock_acquire(&aqo_state->stat_lock, LW_SHARED);
 	hash_seq_init(&hash_seq, stat_htab);
-	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+	while ((hentry = hash_seq_search(&hash_seq)) != NULL)
 	{
+		stat_entry_copy(entry, hentry);
 		memset(nulls, 0, TOTAL_NCOLS + 1);
 
 		values[QUERYID] = Int64GetDatum(entry->queryid);
 		values[NEXECS] = Int64GetDatum(entry->execs_without_aqo);
 		values[NEXECS_AQO] = Int64GetDatum(entry->execs_with_aqo);
-		values[EXEC_TIME_AQO] = PointerGetDatum(form_vector(entry->exec_time_aqo, entry->cur_stat_slot_aqo));
-		values[EXEC_TIME] = PointerGetDatum(form_vector(entry->exec_time, entry->cur_stat_slot));
-		values[PLAN_TIME_AQO] = PointerGetDatum(form_vector(entry->plan_time_aqo, entry->cur_stat_slot_aqo));
-		values[PLAN_TIME] = PointerGetDatum(form_vector(entry->plan_time, entry->cur_stat_slot));
-		values[EST_ERROR_AQO] = PointerGetDatum(form_vector(entry->est_error_aqo, entry->cur_stat_slot_aqo));
-		values[EST_ERROR] = PointerGetDatum(form_vector(entry->est_error, entry->cur_stat_slot));
+		values[EXEC_TIME_AQO] = PointerGetDatum(form_stat_vector(entry->exec_time_aqo, entry->cur_stat_slot_aqo));
+		values[EXEC_TIME] = PointerGetDatum(form_stat_vector(entry->exec_time, entry->cur_stat_slot));
+		values[PLAN_TIME_AQO] = PointerGetDatum(form_stat_vector(entry->plan_time_aqo, entry->cur_stat_slot_aqo));
+		values[PLAN_TIME] = PointerGetDatum(form_stat_vector(entry->plan_time, entry->cur_stat_slot));
+		values[EST_ERROR_AQO] = PointerGetDatum(form_stat_vector(entry->est_error_aqo, entry->cur_stat_slot_aqo));
+		values[EST_ERROR] = PointerGetDatum(form_stat_vector(entry->est_error, entry->cur_stat_slot));
+		form_stat_aggregates(values, nulls, EXEC_TIME_MEAN_AQO,
+							 EXEC_TIME_STDDEV_AQO, EXEC_TIME_QUANTILES_AQO,
+							 EST_ERROR_MEAN_AQO, &entry->exec_time_avg_aqo,
+							 &entry->exec_time_sketch_aqo,
+							 &entry->est_error_avg_aqo);
+		form_stat_aggregates(values, nulls, EXEC_TIME_MEAN, EXEC_TIME_STDDEV,
+							 EXEC_TIME_QUANTILES, EST_ERROR_MEAN,
+							 &entry->exec_time_avg, &entry->exec_time_sketch,
+							 &entry->est_error_avg);
 		tuplestore_putvalues(tupstore, tupDesc, values, nulls);
 	}
 
@@ -434,7 +818,7 @@ aqo_stat_reset(void)
 	long			num_remove = 0;
 	long			num_entries;
 
-	LWLockAcquire(&aqo_state->stat_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->stat_lock, LW_EXCLUSIVE);
 	num_entries = hash_get_num_entries(stat_htab);
 	hash_seq_init(&hash_seq, stat_htab);
 	while ((entry = hash_seq_search(&hash_seq)) != NULL)
@@ -478,7 +862,7 @@ aqo_stat_flush(void)
 	long			entries;
 
 	/* Use exclusive lock to prevent concurrent flushing in different backends. */
-	LWLockAcquire(&aqo_state->stat_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->stat_lock, LW_EXCLUSIVE);
 
 	if (!aqo_state->stat_changed)
 		/* Hash table wasn't changed, meaningless to store it in permanent storage */
@@ -531,7 +915,7 @@ aqo_qtexts_flush(void)
 	long			entries;
 
 	dsa_init();
-	LWLockAcquire(&aqo_state->qtexts_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->qtexts_lock, LW_EXCLUSIVE);
 
 	if (!aqo_state->qtexts_changed)
 		/* XXX: mull over forced mode. */
@@ -595,7 +979,7 @@ aqo_data_flush(void)
 	long			entries;
 
 	dsa_init();
-	LWLockAcquire(&aqo_state->data_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->data_lock, LW_EXCLUSIVE);
 
 	if (!aqo_state->data_changed)
 		/* XXX: mull over forced mode. */
@@ -639,7 +1023,7 @@ aqo_queries_flush(void)
 	int				ret;
 	long			entries;
 
-	LWLockAcquire(&aqo_state->queries_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->queries_lock, LW_EXCLUSIVE);
 
 	if (!aqo_state->queries_changed)
 		goto end;
@@ -667,6 +1051,12 @@ data_store(const char *filename, form_record_t callback,
 	uint32	counter = 0;
 	void   *data;
 	char   *tmpfile;
+	instr_time	start;
+
+	TRACE_AQO_STORAGE_STORE_START(filename);
+	INSTR_TIME_SET_ZERO(start);
+	if (TRACE_AQO_STORAGE_STORE_DONE_ENABLED())
+		INSTR_TIME_SET_CURRENT(start);
 
 	tmpfile = psprintf("%s.tmp", filename);
 	file = AllocateFile(tmpfile, PG_BINARY_W);
@@ -697,6 +1087,9 @@ data_store(const char *filename, form_record_t callback,
 	/* Parallel (re)writing into a file haven't happen. */
 	(void) durable_rename(tmpfile, filename, PANIC);
 	elog(LOG, "[AQO] %d records stored in file %s.", counter, filename);
+	if (TRACE_AQO_STORAGE_STORE_DONE_ENABLED() && !INSTR_TIME_IS_ZERO(start))
+		TRACE_AQO_STORAGE_STORE_DONE(filename, counter,
+									 aqo_trace_elapsed(start));
 	return 0;
 
 error:
@@ -708,9 +1101,61 @@ error:
 		FreeFile(file);
 	unlink(tmpfile);
 	pfree(tmpfile);
+	if (TRACE_AQO_STORAGE_STORE_DONE_ENABLED() && !INSTR_TIME_IS_ZERO(start))
+		TRACE_AQO_STORAGE_STORE_DONE(filename, -1, aqo_trace_elapsed(start));
 	return -1;
 }
 
+/*
+ * Stat record, stored by the previous versions: ring buffers of doubles,
+ * without streaming aggregates.
+ */
+typedef struct StatEntryV1
+{
+	uint64	queryid;
+
+	int64	execs_with_aqo;
+	int64	execs_without_aqo;
+
+	int		cur_stat_slot;
+	double	exec_time[STAT_SAMPLE_SIZE];
+	double	plan_time[STAT_SAMPLE_SIZE];
+	double	est_error[STAT_SAMPLE_SIZE];
+
+	int		cur_stat_slot_aqo;
+	double	exec_time_aqo[STAT_SAMPLE_SIZE];
+	double	plan_time_aqo[STAT_SAMPLE_SIZE];
+	double	est_error_aqo[STAT_SAMPLE_SIZE];
+} StatEntryV1;
+
+/*
+ * Convert the stat record of the previous version and build its streaming
+ * aggregates by the ring buffers.
+ */
+static void
+stat_entry_upgrade(StatEntry *entry, StatEntryV1 *old)
+{
+	memset(entry, 0, sizeof(StatEntry));
+	entry->queryid = old->queryid;
+	entry->execs_with_aqo = old->execs_with_aqo;
+	entry->execs_without_aqo = old->execs_without_aqo;
+
+	entry->cur_stat_slot = Min(old->cur_stat_slot, STAT_SAMPLE_SIZE);
+	stat_ring_fill(entry->exec_time, old->exec_time, entry->cur_stat_slot);
+	stat_ring_fill(entry->plan_time, old->plan_time, entry->cur_stat_slot);
+	stat_ring_fill(entry->est_error, old->est_error, entry->cur_stat_slot);
+
+	entry->cur_stat_slot_aqo = Min(old->cur_stat_slot_aqo, STAT_SAMPLE_SIZE);
+	stat_ring_fill(entry->exec_time_aqo, old->exec_time_aqo,
+				   entry->cur_stat_slot_aqo);
+	stat_ring_fill(entry->plan_time_aqo, old->plan_time_aqo,
+				   entry->cur_stat_slot_aqo);
+	stat_ring_fill(entry->est_error_aqo, old->est_error_aqo,
+				   entry->cur_stat_slot_aqo);
+
+	stat_entry_rebuild_aggregates(entry);
+}
+
 static bool
 _deform_stat_record_cb(void *data, size_t size)
 {
@@ -719,12 +1164,20 @@ _deform_stat_record_cb(void *data, size_t size)
 	uint64		queryid;
 
 	Assert(LWLockHeldByMeInMode(&aqo_state->stat_lock, LW_EXCLUSIVE));
-	Assert(size == sizeof(StatEntry));
+
+	if (size != sizeof(StatEntry) && size != sizeof(StatEntryV1))
+		return false;
 
 	queryid = ((StatEntry *) data)->queryid;
 	entry = (StatEntry *) hash_search(stat_htab, &queryid, HASH_ENTER, &found);
 	Assert(!found && entry);
-	memcpy(entry, data, sizeof(StatEntry));
+
+	if (size == sizeof(StatEntry))
+		memcpy(entry, data, size);
+	else
+		stat_entry_upgrade(entry, (StatEntryV1 *) data);
+
+	SpinLockInit(&((StatHashEntry *) entry)->mutex);
 	return true;
 }
 
@@ -733,7 +1186,7 @@ aqo_stat_load(void)
 {
 	Assert(!LWLockHeldByMe(&aqo_state->stat_lock));
 
-	LWLockAcquire(&aqo_state->stat_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->stat_lock, LW_EXCLUSIVE);
 
 	/* Load on postmaster sturtup. So no any concurrent actions possible here. */
 	Assert(hash_get_num_entries(stat_htab) == 0);
@@ -769,7 +1222,7 @@ _deform_qtexts_record_cb(void *data, size_t size)
 										   HASH_ENTER, &found);
 	Assert(!found);
 
-	entry->qtext_dp = dsa_allocate(qtext_dsa, len);
+	entry->qtext_dp = _dsa_allocate(AQO_DSA_QTEXTS, len, false);
 	if (!_check_dsa_validity(entry->qtext_dp))
 	{
 		/*
@@ -794,7 +1247,7 @@ aqo_qtexts_load(void)
 	Assert(!LWLockHeldByMe(&aqo_state->qtexts_lock));
 	Assert(qtext_dsa != NULL);
 
-	LWLockAcquire(&aqo_state->qtexts_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->qtexts_lock, LW_EXCLUSIVE);
 
 	if (hash_get_num_entries(qtexts_htab) != 0)
 	{
@@ -846,7 +1299,7 @@ _deform_data_record_cb(void *data, size_t size)
 
 	sz = _compute_data_dsa(entry);
 	Assert(sz + offsetof(DataEntry, data_dp) == size);
-	entry->data_dp = dsa_allocate(data_dsa, sz);
+	entry->data_dp = _dsa_allocate(AQO_DSA_DATA, sz, false);
 
 	if (!_check_dsa_validity(entry->data_dp))
 	{
@@ -870,7 +1323,7 @@ aqo_data_load(void)
 	Assert(!LWLockHeldByMe(&aqo_state->data_lock));
 	Assert(data_dsa != NULL);
 
-	LWLockAcquire(&aqo_state->data_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->data_lock, LW_EXCLUSIVE);
 
 	if (hash_get_num_entries(data_htab) != 0)
 	{
@@ -894,12 +1347,26 @@ _deform_queries_record_cb(void *data, size_t size)
 	uint64			queryid;
 
 	Assert(LWLockHeldByMeInMode(&aqo_state->queries_lock, LW_EXCLUSIVE));
-	Assert(size == sizeof(QueriesEntry));
+
+	/*
+	 * Records, stored by a previous version, can be shorter. Fields, added at
+	 * the tail of the entry later, are zeroed in this case.
+	 */
+	if (size > sizeof(QueriesEntry))
+		return false;
 
 	queryid = ((QueriesEntry *) data)->queryid;
 	entry = (QueriesEntry *) hash_search(queries_htab, &queryid, HASH_ENTER, &found);
 	Assert(!found);
-	memcpy(entry, data, sizeof(QueriesEntry));
+	memset(entry, 0, sizeof(QueriesEntry));
+	memcpy(entry, data, size);
+
+	if (size < offsetof(QueriesEntry, learn_error) + sizeof(double))
+	{
+		entry->learn_rate = 1.;
+		entry->learn_error = -1.;
+	}
+	SpinLockInit(&((QueriesHashEntry *) entry)->mutex);
 	return true;
 }
 
@@ -911,7 +1378,7 @@ aqo_queries_load(void)
 
 	Assert(!LWLockHeldByMe(&aqo_state->queries_lock));
 
-	LWLockAcquire(&aqo_state->queries_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->queries_lock, LW_EXCLUSIVE);
 
 	/* Load on postmaster startup. So no any concurrent actions possible here. */
 	Assert(hash_get_num_entries(queries_htab) == 0);
@@ -937,12 +1404,20 @@ data_load(const char *filename, deform_record_t callback, void *ctx)
 	uint32	header;
 	int32	pgver;
 	long	num;
+	instr_time	start;
+
+	TRACE_AQO_STORAGE_LOAD_START(filename);
+	INSTR_TIME_SET_ZERO(start);
+	if (TRACE_AQO_STORAGE_LOAD_DONE_ENABLED())
+		INSTR_TIME_SET_CURRENT(start);
 
 	file = AllocateFile(filename, PG_BINARY_R);
 	if (file == NULL)
 	{
 		if (errno != ENOENT)
 			goto read_error;
+		if (TRACE_AQO_STORAGE_LOAD_DONE_ENABLED() && !INSTR_TIME_IS_ZERO(start))
+			TRACE_AQO_STORAGE_LOAD_DONE(filename, 0, aqo_trace_elapsed(start));
 		return;
 	}
 
@@ -979,6 +1454,8 @@ data_load(const char *filename, deform_record_t callback, void *ctx)
 	FreeFile(file);
 
 	elog(LOG, "[AQO] %ld records loaded from file %s.", num, filename);
+	if (TRACE_AQO_STORAGE_LOAD_DONE_ENABLED() && !INSTR_TIME_IS_ZERO(start))
+		TRACE_AQO_STORAGE_LOAD_DONE(filename, i, aqo_trace_elapsed(start));
 	return;
 
 read_error:
@@ -994,6 +1471,8 @@ fail:
 	if (file)
 		FreeFile(file);
 	unlink(filename);
+	if (TRACE_AQO_STORAGE_LOAD_DONE_ENABLED() && !INSTR_TIME_IS_ZERO(start))
+		TRACE_AQO_STORAGE_LOAD_DONE(filename, -1, aqo_trace_elapsed(start));
 }
 
 static void
@@ -1021,7 +1500,7 @@ dsa_init()
 
 	Assert(data_dsa == NULL && data_dsa == NULL);
 	old_context = MemoryContextSwitchTo(TopMemoryContext);
-	LWLockAcquire(&aqo_state->lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->lock, LW_EXCLUSIVE);
 
 	if (aqo_state->qtexts_dsa_handler == DSM_HANDLE_INVALID)
 	{
@@ -1076,7 +1555,7 @@ aqo_qtext_store(uint64 queryid, const char *query_string)
 
 	dsa_init();
 
-	LWLockAcquire(&aqo_state->qtexts_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->qtexts_lock, LW_EXCLUSIVE);
 
 	/* Check hash table overflow */
 	tblOverflow = hash_get_num_entries(qtexts_htab) < fs_max_items ? false : true;
@@ -1107,7 +1586,7 @@ aqo_qtext_store(uint64 queryid, const char *query_string)
 
 		entry->queryid = queryid;
 		size = size > querytext_max_size ? querytext_max_size : size;
-		entry->qtext_dp = dsa_allocate(qtext_dsa, size);
+		entry->qtext_dp = _dsa_allocate(AQO_DSA_QTEXTS, size, false);
 
 		if (!_check_dsa_validity(entry->qtext_dp))
 		{
@@ -1171,7 +1650,7 @@ aqo_query_texts(PG_FUNCTION_ARGS)
 
 	dsa_init();
 	memset(nulls, 0, QT_TOTAL_NCOLS);
-	LWLockAcquire(&aqo_state->qtexts_lock, LW_SHARED);
+	aqo_lwlock_acquire(&aqo_state->qtexts_lock, LW_SHARED);
 	hash_seq_init(&hash_seq, qtexts_htab);
 	while ((entry = hash_seq_search(&hash_seq)) != NULL)
 	{
@@ -1195,7 +1674,7 @@ _aqo_stat_remove(uint64 queryid)
 	bool		found;
 
 	Assert(!LWLockHeldByMe(&aqo_state->stat_lock));
-	LWLockAcquire(&aqo_state->stat_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->stat_lock, LW_EXCLUSIVE);
 	(void) hash_search(stat_htab, &queryid, HASH_FIND, &found);
 
 	if (found)
@@ -1214,7 +1693,7 @@ _aqo_queries_remove(uint64 queryid)
 	bool	found;
 
 	Assert(!LWLockHeldByMe(&aqo_state->queries_lock));
-	LWLockAcquire(&aqo_state->queries_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->queries_lock, LW_EXCLUSIVE);
 	(void) hash_search(queries_htab, &queryid, HASH_FIND, &found);
 
 	if (found)
@@ -1236,7 +1715,7 @@ _aqo_qtexts_remove(uint64 queryid)
 	dsa_init();
 
 	Assert(!LWLockHeldByMe(&aqo_state->qtexts_lock));
-	LWLockAcquire(&aqo_state->qtexts_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->qtexts_lock, LW_EXCLUSIVE);
 
 	/*
 	 * Look for a record with this queryid. DSA fields must be freed before
@@ -1248,7 +1727,8 @@ _aqo_qtexts_remove(uint64 queryid)
 	{
 		/* Free DSA memory, allocated for this record */
 		Assert(DsaPointerIsValid(entry->qtext_dp));
-		dsa_free(qtext_dsa, entry->qtext_dp);
+		_dsa_free(AQO_DSA_QTEXTS, entry->qtext_dp,
+				  _compute_qtext_dsa(entry));
 
 		(void) hash_search(qtexts_htab, &queryid, HASH_REMOVE, NULL);
 		aqo_state->qtexts_changed = true;
@@ -1265,14 +1745,14 @@ _aqo_data_remove(data_key *key)
 	bool		found;
 
 	Assert(!LWLockHeldByMe(&aqo_state->data_lock));
-	LWLockAcquire(&aqo_state->data_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->data_lock, LW_EXCLUSIVE);
 
 	entry = (DataEntry *) hash_search(data_htab, key, HASH_FIND, &found);
 	if (found)
 	{
 		/* Free DSA memory, allocated for this record */
 		Assert(DsaPointerIsValid(entry->data_dp));
-		dsa_free(data_dsa, entry->data_dp);
+		_dsa_free(AQO_DSA_DATA, entry->data_dp, _compute_data_dsa(entry));
 		entry->data_dp = InvalidDsaPointer;
 
 		if (!hash_search(data_htab, key, HASH_REMOVE, NULL))
@@ -1296,7 +1776,7 @@ aqo_qtexts_reset(void)
 	dsa_init();
 
 	Assert(!LWLockHeldByMe(&aqo_state->qtexts_lock));
-	LWLockAcquire(&aqo_state->qtexts_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->qtexts_lock, LW_EXCLUSIVE);
 	num_entries = hash_get_num_entries(qtexts_htab);
 	hash_seq_init(&hash_seq, qtexts_htab);
 	while ((entry = hash_seq_search(&hash_seq)) != NULL)
@@ -1305,7 +1785,8 @@ aqo_qtexts_reset(void)
 			continue;
 
 		Assert(DsaPointerIsValid(entry->qtext_dp));
-		dsa_free(qtext_dsa, entry->qtext_dp);
+		_dsa_free(AQO_DSA_QTEXTS, entry->qtext_dp,
+				  _compute_qtext_dsa(entry));
 		if (!hash_search(qtexts_htab, &entry->queryid, HASH_REMOVE, NULL))
 			elog(PANIC, "[AQO] hash table corrupted");
 		num_remove++;
@@ -1333,6 +1814,37 @@ _compute_data_dsa(const DataEntry *entry)
 	return size;
 }
 
+static size_t
+_compute_qtext_dsa(const QueryTextEntry *entry)
+{
+	return strlen((char *) dsa_get_address(qtext_dsa, entry->qtext_dp)) + 1;
+}
+
+/*
+ * Allocate and free memory in the DSA areas of the storage, keeping the
+ * counters of aqo_dsa_stat().
+ */
+static dsa_pointer
+_dsa_allocate(AqoDsaArea area, size_t size, bool zero)
+{
+	dsa_area   *dsa = (area == AQO_DSA_QTEXTS) ? qtext_dsa : data_dsa;
+	dsa_pointer	dp;
+
+	dp = zero ? dsa_allocate0(dsa, size) : dsa_allocate(dsa, size);
+	if (DsaPointerIsValid(dp))
+		aqo_dsa_count(area, size, true);
+	return dp;
+}
+
+static void
+_dsa_free(AqoDsaArea area, dsa_pointer dp, size_t size)
+{
+	dsa_area   *dsa = (area == AQO_DSA_QTEXTS) ? qtext_dsa : data_dsa;
+
+	dsa_free(dsa, dp);
+	aqo_dsa_count(area, size, false);
+}
+
 /*
  * Insert new record or update existed in the AQO data storage.
  * Return true if data was changed.
@@ -1363,7 +1875,7 @@ aqo_data_store(uint64 fs, int fss, AqoDataArgs *data, List *reloids)
 
 	dsa_init();
 
-	LWLockAcquire(&aqo_state->data_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->data_lock, LW_EXCLUSIVE);
 
 	/* Check hash table overflow */
 	tblOverflow = hash_get_num_entries(data_htab) < fss_max_items ? false : true;
@@ -1393,7 +1905,7 @@ aqo_data_store(uint64 fs, int fss, AqoDataArgs *data, List *reloids)
 		entry->nrels = nrels;
 
 		size = _compute_data_dsa(entry);
-		entry->data_dp = dsa_allocate0(data_dsa, size);
+		entry->data_dp = _dsa_allocate(AQO_DSA_DATA, size, true);
 
 		if (!_check_dsa_validity(entry->data_dp))
 		{
@@ -1415,17 +1927,18 @@ aqo_data_store(uint64 fs, int fss, AqoDataArgs *data, List *reloids)
 		elog(LOG, "[AQO] Does a collision happened? Check it if possible (fs: "
 			 UINT64_FORMAT", fss: %d).",
 			 fs, fss);
+		aqo_collision_count();
 		goto end;
 	}
 
 	if (entry->rows < data->rows)
 	{
+		/* Need to re-allocate DSA chunk */
+		_dsa_free(AQO_DSA_DATA, entry->data_dp, _compute_data_dsa(entry));
+
 		entry->rows = data->rows;
 		size = _compute_data_dsa(entry);
-
-		/* Need to re-allocate DSA chunk */
-		dsa_free(data_dsa, entry->data_dp);
-		entry->data_dp = dsa_allocate0(data_dsa, size);
+		entry->data_dp = _dsa_allocate(AQO_DSA_DATA, size, true);
 
 		if (!_check_dsa_validity(entry->data_dp))
 		{
@@ -1646,7 +2159,7 @@ load_aqo_data(uint64 fs, int fss, OkNNrdata *data, List **reloids,
 
 	dsa_init();
 
-	LWLockAcquire(&aqo_state->data_lock, LW_SHARED);
+	aqo_lwlock_acquire(&aqo_state->data_lock, LW_SHARED);
 
 	if (!wideSearch)
 	{
@@ -1665,6 +2178,7 @@ load_aqo_data(uint64 fs, int fss, OkNNrdata *data, List **reloids,
 			elog(LOG, "[AQO] Does a collision happened? Check it if possible "
 				 "(fs: "UINT64_FORMAT", fss: %d).",
 				 fs, fss);
+			aqo_collision_count();
 			found = false; /* Sign of unsuccessful operation */
 			goto end;
 		}
@@ -1679,6 +2193,7 @@ load_aqo_data(uint64 fs, int fss, OkNNrdata *data, List **reloids,
 	{
 		HASH_SEQ_STATUS	hash_seq;
 		int				noids = -1;
+		int64			nscanned = 0;
 
 		found = false;
 		hash_seq_init(&hash_seq, data_htab);
@@ -1687,6 +2202,7 @@ load_aqo_data(uint64 fs, int fss, OkNNrdata *data, List **reloids,
 			List *tmp_oids = NIL;
 
 			Assert(entry->rows > 0);
+			nscanned++;
 
 			if (entry->key.fss != fss || entry->cols != data->cols)
 				continue;
@@ -1715,6 +2231,8 @@ load_aqo_data(uint64 fs, int fss, OkNNrdata *data, List **reloids,
 			build_knn_matrix(data, temp_data, NULL);
 			found = true;
 		}
+
+		aqo_wide_search_count(nscanned);
 	}
 
 	Assert(!found || (data->rows > 0 && data->rows <= aqo_K));
@@ -1766,7 +2284,7 @@ aqo_data(PG_FUNCTION_ARGS)
 	MemoryContextSwitchTo(oldcontext);
 
 	dsa_init();
-	LWLockAcquire(&aqo_state->data_lock, LW_SHARED);
+	aqo_lwlock_acquire(&aqo_state->data_lock, LW_SHARED);
 	hash_seq_init(&hash_seq, data_htab);
 	while ((entry = hash_seq_search(&hash_seq)) != NULL)
 	{
@@ -1832,7 +2350,7 @@ _aqo_data_clean(uint64 fs)
 	long			removed = 0;
 
 	Assert(!LWLockHeldByMe(&aqo_state->data_lock));
-	LWLockAcquire(&aqo_state->data_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->data_lock, LW_EXCLUSIVE);
 
 	hash_seq_init(&hash_seq, data_htab);
 	while ((entry = hash_seq_search(&hash_seq)) != NULL)
@@ -1841,7 +2359,7 @@ _aqo_data_clean(uint64 fs)
 			continue;
 
 		Assert(DsaPointerIsValid(entry->data_dp));
-		dsa_free(data_dsa, entry->data_dp);
+		_dsa_free(AQO_DSA_DATA, entry->data_dp, _compute_data_dsa(entry));
 		entry->data_dp = InvalidDsaPointer;
 		if (!hash_search(data_htab, &entry->key, HASH_REMOVE, NULL))
 			elog(PANIC, "[AQO] hash table corrupted");
@@ -1863,13 +2381,13 @@ aqo_data_reset(void)
 	dsa_init();
 
 	Assert(!LWLockHeldByMe(&aqo_state->data_lock));
-	LWLockAcquire(&aqo_state->data_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->data_lock, LW_EXCLUSIVE);
 	num_entries = hash_get_num_entries(data_htab);
 	hash_seq_init(&hash_seq, data_htab);
 	while ((entry = hash_seq_search(&hash_seq)) != NULL)
 	{
 		Assert(DsaPointerIsValid(entry->data_dp));
-		dsa_free(data_dsa, entry->data_dp);
+		_dsa_free(AQO_DSA_DATA, entry->data_dp, _compute_data_dsa(entry));
 		if (!hash_search(data_htab, &entry->key, HASH_REMOVE, NULL))
 			elog(PANIC, "[AQO] hash table corrupted");
 		num_remove++;
@@ -1925,7 +2443,7 @@ aqo_queries(PG_FUNCTION_ARGS)
 
 	MemoryContextSwitchTo(oldcontext);
 
-	LWLockAcquire(&aqo_state->queries_lock, LW_SHARED);
+	aqo_lwlock_acquire(&aqo_state->queries_lock, LW_SHARED);
 	hash_seq_init(&hash_seq, queries_htab);
 	while ((entry = hash_seq_search(&hash_seq)) != NULL)
 	{
@@ -1938,6 +2456,12 @@ aqo_queries(PG_FUNCTION_ARGS)
 		values[AQ_AUTO_TUNING] = BoolGetDatum(entry->auto_tuning);
 		values[AQ_SMART_TIMEOUT] = Int64GetDatum(entry->smart_timeout);
 		values[AQ_COUNT_INCREASE_TIMEOUT] = Int64GetDatum(entry->count_increase_timeout);
+		SpinLockAcquire(&((QueriesHashEntry *) entry)->mutex);
+		values[AQ_PLAN_OVERHEAD] = Float8GetDatum(entry->plan_overhead);
+		values[AQ_PLAN_DEGRADATION] = Int32GetDatum(entry->plan_degradation);
+		values[AQ_JOIN_LIMIT] = Int32GetDatum(entry->join_limit);
+		values[AQ_LEARN_RATE] = Float8GetDatum(entry->learn_rate);
+		SpinLockRelease(&((QueriesHashEntry *) entry)->mutex);
 		tuplestore_putvalues(tupstore, tupDesc, values, nulls);
 	}
 
@@ -1967,7 +2491,7 @@ aqo_queries_store(uint64 queryid,
 	Assert(queryid != 0 || (fs == 0 && learn_aqo == false &&
 		   use_aqo == false && auto_tuning == false));
 
-	LWLockAcquire(&aqo_state->queries_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->queries_lock, LW_EXCLUSIVE);
 
 	/* Check hash table overflow */
 	tblOverflow = hash_get_num_entries(queries_htab) < fs_max_items ? false : true;
@@ -2004,6 +2528,17 @@ aqo_queries_store(uint64 queryid,
 	if (!null_args->count_increase_timeout)
 		entry->count_increase_timeout = 0;
 
+	if (!found)
+	{
+		entry->plan_overhead = 0.;
+		entry->plan_degradation = AQO_DEGRADE_NONE;
+		entry->join_limit = 0;
+		entry->plan_overhead_streak = 0;
+		entry->learn_rate = 1.;
+		entry->learn_error = -1.;
+		SpinLockInit(&((QueriesHashEntry *) entry)->mutex);
+	}
+
 	if (entry->learn_aqo || entry->use_aqo || entry->auto_tuning)
 		/* Remove the class from cache of deactivated queries */
 		hash_search(deactivated_queries, &queryid, HASH_REMOVE, NULL);
@@ -2022,7 +2557,7 @@ aqo_queries_reset(void)
 	long				num_remove = 0;
 	long				num_entries;
 
-	LWLockAcquire(&aqo_state->queries_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->queries_lock, LW_EXCLUSIVE);
 	num_entries = hash_get_num_entries(queries_htab);
 	hash_seq_init(&hash_seq, queries_htab);
 	while ((entry = hash_seq_search(&hash_seq)) != NULL)
@@ -2061,7 +2596,7 @@ aqo_enable_query(PG_FUNCTION_ARGS)
 	if (queryid == 0)
 		elog(ERROR, "[AQO] Default class can't be updated.");
 
-	LWLockAcquire(&aqo_state->queries_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->queries_lock, LW_EXCLUSIVE);
 	entry = (QueriesEntry *) hash_search(queries_htab, &queryid, HASH_FIND, &found);
 
 	if (found)
@@ -2070,6 +2605,14 @@ aqo_enable_query(PG_FUNCTION_ARGS)
 		entry->use_aqo = true;
 		if (aqo_mode == AQO_MODE_INTELLIGENT)
 			entry->auto_tuning = true;
+
+		/* Give the class another chance with the full-featured prediction */
+		entry->plan_overhead = 0.;
+		entry->plan_degradation = AQO_DEGRADE_NONE;
+		entry->join_limit = 0;
+		entry->plan_overhead_streak = 0;
+		entry->learn_rate = 1.;
+		entry->learn_error = -1.;
 	}
 	else
 		elog(ERROR, "[AQO] Entry with queryid "INT64_FORMAT
@@ -2089,7 +2632,7 @@ aqo_disable_query(PG_FUNCTION_ARGS)
 
 	Assert(queries_htab);
 
-	LWLockAcquire(&aqo_state->queries_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->queries_lock, LW_EXCLUSIVE);
 	entry = (QueriesEntry *) hash_search(queries_htab, &queryid, HASH_FIND, &found);
 
 	if(found)
@@ -2115,7 +2658,7 @@ aqo_queries_find(uint64 queryid, QueryContextData *ctx)
 
 	Assert(queries_htab);
 
-	LWLockAcquire(&aqo_state->queries_lock, LW_SHARED);
+	aqo_lwlock_acquire(&aqo_state->queries_lock, LW_SHARED);
 	entry = (QueriesEntry *) hash_search(queries_htab, &queryid, HASH_FIND, &found);
 	if (found)
 	{
@@ -2125,6 +2668,11 @@ aqo_queries_find(uint64 queryid, QueryContextData *ctx)
 		ctx->auto_tuning = entry->auto_tuning;
 		ctx->smart_timeout = entry->smart_timeout;
 		ctx->count_increase_timeout = entry->count_increase_timeout;
+		SpinLockAcquire(&((QueriesHashEntry *) entry)->mutex);
+		ctx->plan_degradation = entry->plan_degradation;
+		ctx->join_limit = entry->join_limit;
+		ctx->learn_rate = entry->learn_rate;
+		SpinLockRelease(&((QueriesHashEntry *) entry)->mutex);
 	}
 	LWLockRelease(&aqo_state->queries_lock);
 	return found;
@@ -2147,7 +2695,7 @@ update_query_timeout(uint64 queryid, int64 smart_timeout)
 	/* Guard for default feature space */
 	Assert(queryid != 0);
 
-	LWLockAcquire(&aqo_state->queries_lock, LW_EXCLUSIVE);
+	aqo_lwlock_acquire(&aqo_state->queries_lock, LW_EXCLUSIVE);
 
 	/* Check hash table overflow */
 	tblOverflow = hash_get_num_entries(queries_htab) < fs_max_items ? false : true;
@@ -2167,6 +2715,9 @@ update_query_timeout(uint64 queryid, int64 smart_timeout)
 		return false;
 	}
 
+	if (!found)
+		SpinLockInit(&((QueriesHashEntry *) entry)->mutex);
+
 	entry->smart_timeout = smart_timeout;
 	entry->count_increase_timeout = entry->count_increase_timeout + 1;
 
@@ -2174,6 +2725,160 @@ update_query_timeout(uint64 queryid, int64 smart_timeout)
 	return true;
 }
 
+/*
+ * Account the share of AQO estimation hooks in the planning time of the query
+ * class. The share is smoothed over executions. If it stays over the
+ * aqo.planning_overhead_limit for PLAN_OVERHEAD_SAMPLES executions in a row,
+ * the prediction for the class is degraded by one more step. If it stays well
+ * below the limit as long, one step of the degradation is taken back.
+ * max_join_rels is the number of relations in the largest join, predicted
+ * during the planning.
+ *
+ * Doesn't add new classes. Returns false if the class isn't found.
+ */
+bool
+update_query_plan_overhead(uint64 queryid, double overhead, int max_join_rels)
+{
+	QueriesHashEntry   *hentry;
+	QueriesEntry	   *entry;
+	bool				found;
+	bool				changed;
+	int					degradation;
+	int					join_limit;
+
+	Assert(queries_htab);
+	Assert(queryid != 0);
+
+	aqo_lwlock_acquire(&aqo_state->queries_lock, LW_SHARED);
+	hentry = (QueriesHashEntry *) hash_search(queries_htab, &queryid,
+											  HASH_FIND, &found);
+	if (!found)
+	{
+		LWLockRelease(&aqo_state->queries_lock);
+		return false;
+	}
+
+	entry = &hentry->entry;
+	SpinLockAcquire(&hentry->mutex);
+	degradation = entry->plan_degradation;
+	join_limit = entry->join_limit;
+
+	if (entry->plan_overhead <= 0.)
+		entry->plan_overhead = overhead;
+	else
+		entry->plan_overhead = PLAN_OVERHEAD_SMOOTHING * overhead +
+						(1. - PLAN_OVERHEAD_SMOOTHING) * entry->plan_overhead;
+
+	if (entry->plan_overhead > aqo_planning_overhead_limit)
+		entry->plan_overhead_streak = Max(entry->plan_overhead_streak, 0) + 1;
+	else if (entry->plan_degradation > AQO_DEGRADE_NONE &&
+			 entry->plan_overhead <
+							aqo_planning_overhead_limit * PLAN_OVERHEAD_RECOVERY)
+		entry->plan_overhead_streak = Min(entry->plan_overhead_streak, 0) - 1;
+	else
+		entry->plan_overhead_streak = 0;
+
+	if (entry->plan_overhead_streak >= PLAN_OVERHEAD_SAMPLES)
+	{
+		if (entry->plan_degradation < AQO_DEGRADE_JOIN_LIMIT)
+		{
+			entry->plan_degradation++;
+			if (entry->plan_degradation == AQO_DEGRADE_JOIN_LIMIT)
+				entry->join_limit = max_join_rels;
+		}
+
+		/* Don't predict for the largest joins left */
+		if (entry->plan_degradation == AQO_DEGRADE_JOIN_LIMIT &&
+			entry->join_limit > 2)
+			entry->join_limit--;
+
+		entry->plan_overhead_streak = 0;
+	}
+	else if (entry->plan_overhead_streak <= -PLAN_OVERHEAD_SAMPLES)
+	{
+		/*
+		 * Joins of more than join_limit relations aren't predicted, so the
+		 * limit is in effect while the largest predicted join reaches it.
+		 */
+		if (entry->plan_degradation == AQO_DEGRADE_JOIN_LIMIT &&
+			entry->join_limit > 0 && entry->join_limit <= max_join_rels)
+			entry->join_limit++;
+		else
+		{
+			entry->plan_degradation--;
+			entry->join_limit = 0;
+		}
+
+		entry->plan_overhead_streak = 0;
+	}
+
+	/* Only a change of the degradation is worth to be stored on disk */
+	changed = (entry->plan_degradation != degradation ||
+			   entry->join_limit != join_limit);
+	SpinLockRelease(&hentry->mutex);
+
+	if (changed)
+		aqo_state->queries_changed = true;
+	LWLockRelease(&aqo_state->queries_lock);
+	return true;
+}
+
+/*
+ * Update the learning sampling rate of the query class with the cardinality
+ * error of its last execution, learned or not. While the error doesn't change,
+ * the rate decays down to aqo.learn_rate_min. Any drift of the error returns
+ * the rate to 1.
+ *
+ * Doesn't add new classes. Returns false if the class isn't found.
+ */
+bool
+update_query_learn_rate(uint64 queryid, double error)
+{
+	QueriesHashEntry   *hentry;
+	QueriesEntry	   *entry;
+	bool				found;
+	bool				changed;
+	double				learn_rate;
+
+	Assert(queries_htab);
+	Assert(queryid != 0 && error >= 0.);
+
+	aqo_lwlock_acquire(&aqo_state->queries_lock, LW_SHARED);
+	hentry = (QueriesHashEntry *) hash_search(queries_htab, &queryid,
+											  HASH_FIND, &found);
+	if (!found)
+	{
+		LWLockRelease(&aqo_state->queries_lock);
+		return false;
+	}
+
+	entry = &hentry->entry;
+	SpinLockAcquire(&hentry->mutex);
+	learn_rate = entry->learn_rate;
+
+	if (entry->learn_error >= 0. &&
+		fabs(error - entry->learn_error) <= LEARN_RATE_DRIFT)
+		entry->learn_rate = Max(entry->learn_rate * LEARN_RATE_DECAY,
+								aqo_learn_rate_min);
+	else
+		entry->learn_rate = 1.;
+
+	if (entry->learn_error < 0.)
+		entry->learn_error = error;
+	else
+		entry->learn_error = LEARN_RATE_SMOOTHING * error +
+							(1. - LEARN_RATE_SMOOTHING) * entry->learn_error;
+
+	/* The smoothed error alone isn't worth to be stored on disk */
+	changed = (entry->learn_rate != learn_rate);
+	SpinLockRelease(&hentry->mutex);
+
+	if (changed)
+		aqo_state->queries_changed = true;
+	LWLockRelease(&aqo_state->queries_lock);
+	return true;
+}
+
 /*
  * Update AQO preferences for a given queryid value.
  * if incoming param is null - leave it unchanged.
@@ -2228,9 +2933,36 @@ aqo_reset(PG_FUNCTION_ARGS)
 	/* Cleanup cache of deactivated queries */
 	reset_deactivated_queries();
 
+	pg_atomic_write_u64(&aqo_state->learned_samples, 0);
+	pg_atomic_write_u64(&aqo_state->skipped_samples, 0);
+
+	/* Counters aren't a part of the knowledge base, don't count them */
+	aqo_counters_reset();
+
 	PG_RETURN_INT64(counter);
 }
 
+/*
+ * Return numbers of learning samples, passed to the knowledge base and skipped
+ * because of the accurate prediction, since the last aqo_reset().
+ */
+Datum
+aqo_learning_counters(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupDesc;
+	Datum		values[2];
+	bool		nulls[2] = {false, false};
+
+	if (get_call_result_type(fcinfo, NULL, &tupDesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	Assert(tupDesc->natts == 2);
+
+	values[0] = Int64GetDatum(pg_atomic_read_u64(&aqo_state->learned_samples));
+	values[1] = Int64GetDatum(pg_atomic_read_u64(&aqo_state->skipped_samples));
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupDesc, values, nulls)));
+}
+
 #include "utils/syscache.h"
 
 /*
@@ -2279,7 +3011,7 @@ cleanup_aqo_database(bool gentle, int *fs_num, int *fss_num)
 				/* Another FS */
 				continue;
 
-			LWLockAcquire(&aqo_state->data_lock, LW_SHARED);
+			aqo_lwlock_acquire(&aqo_state->data_lock, LW_SHARED);
 
 			Assert(DsaPointerIsValid(dentry->data_dp));
 			ptr = dsa_get_address(data_dsa, dentry->data_dp);
@@ -2352,6 +3084,9 @@ cleanup_aqo_database(bool gentle, int *fs_num, int *fss_num)
 
 			/* Query class preferences */
 			(*fs_num) += (int) _aqo_queries_remove(entry->queryid);
+
+			/* Overhead and prediction counters */
+			aqo_counters_remove(entry->queryid);
 		}
 	}
 
@@ -2417,7 +3152,7 @@ aqo_drop_class(PG_FUNCTION_ARGS)
 			 (int64) queryid);
 
 	/* Extract FS value for the queryid */
-	LWLockAcquire(&aqo_state->queries_lock, LW_SHARED);
+	aqo_lwlock_acquire(&aqo_state->queries_lock, LW_SHARED);
 	entry = (QueriesEntry *) hash_search(queries_htab, &queryid, HASH_FIND,
 										 &found);
 	if (!found)
@@ -2439,6 +3174,7 @@ aqo_drop_class(PG_FUNCTION_ARGS)
 	_aqo_queries_remove(queryid);
 	_aqo_stat_remove(queryid);
 	_aqo_qtexts_remove(queryid);
+	aqo_counters_remove(queryid);
 	cnt = _aqo_data_clean(fs);
 
 	/* Immediately save changes to permanent storage. */
@@ -2471,7 +3207,9 @@ aqo_cardinality_error(PG_FUNCTION_ARGS)
 	bool				nulls[AQE_TOTAL_NCOLS];
 	HASH_SEQ_STATUS		hash_seq;
 	QueriesEntry	   *qentry;
-	StatEntry		   *sentry;
+	StatHashEntry	   *hentry;
+	StatEntry			sentry_copy;
+	StatEntry		   *sentry = &sentry_copy;
 	int					counter = 0;
 
 	/* check to see if caller supports us returning a tuplestore */
@@ -2500,25 +3238,27 @@ aqo_cardinality_error(PG_FUNCTION_ARGS)
 
 	MemoryContextSwitchTo(oldcontext);
 
-	LWLockAcquire(&aqo_state->queries_lock, LW_SHARED);
-	LWLockAcquire(&aqo_state->stat_lock, LW_SHARED);
+	aqo_lwlock_acquire(&aqo_state->queries_lock, LW_SHARED);
+	aqo_lwlock_acquire(&aqo_state->stat_lock, LW_SHARED);
 
 	hash_seq_init(&hash_seq, queries_htab);
 	while ((qentry = hash_seq_search(&hash_seq)) != NULL)
 	{
 		bool	found;
-		double *ce;
+		float4 *ce;
 		int64	nexecs;
 		int		nvals;
 
 		memset(nulls, 0, AQE_TOTAL_NCOLS * sizeof(nulls[0]));
 
-		sentry = (StatEntry *) hash_search(stat_htab, &qentry->queryid,
-										   HASH_FIND, &found);
+		hentry = (StatHashEntry *) hash_search(stat_htab, &qentry->queryid,
+											   HASH_FIND, &found);
 		if (!found)
 			/* Statistics not found by some reason. Just go further */
 			continue;
 
+		stat_entry_copy(sentry, hentry);
+
 		nvals = controlled ? sentry->cur_stat_slot_aqo : sentry->cur_stat_slot;
 		if (nvals == 0)
 			/* No one stat slot filled */
@@ -2563,7 +3303,9 @@ aqo_execution_time(PG_FUNCTION_ARGS)
 	bool				nulls[AQE_TOTAL_NCOLS];
 	HASH_SEQ_STATUS		hash_seq;
 	QueriesEntry	   *qentry;
-	StatEntry		   *sentry;
+	StatHashEntry	   *hentry;
+	StatEntry			sentry_copy;
+	StatEntry		   *sentry = &sentry_copy;
 	int					counter = 0;
 
 	/* check to see if caller supports us returning a tuplestore */
@@ -2592,26 +3334,28 @@ aqo_execution_time(PG_FUNCTION_ARGS)
 
 	MemoryContextSwitchTo(oldcontext);
 
-	LWLockAcquire(&aqo_state->queries_lock, LW_SHARED);
-	LWLockAcquire(&aqo_state->stat_lock, LW_SHARED);
+	aqo_lwlock_acquire(&aqo_state->queries_lock, LW_SHARED);
+	aqo_lwlock_acquire(&aqo_state->stat_lock, LW_SHARED);
 
 	hash_seq_init(&hash_seq, queries_htab);
 	while ((qentry = hash_seq_search(&hash_seq)) != NULL)
 	{
 		bool	found;
-		double *et;
+		float4 *et;
 		int64	nexecs;
 		int		nvals;
 		double	tm = 0;
 
 		memset(nulls, 0, ET_TOTAL_NCOLS * sizeof(nulls[0]));
 
-		sentry = (StatEntry *) hash_search(stat_htab, &qentry->queryid,
-										   HASH_FIND, &found);
+		hentry = (StatHashEntry *) hash_search(stat_htab, &qentry->queryid,
+											   HASH_FIND, &found);
 		if (!found)
 			/* Statistics not found by some reason. Just go further */
 			continue;
 
+		stat_entry_copy(sentry, hentry);
+
 		nvals = controlled ? sentry->cur_stat_slot_aqo : sentry->cur_stat_slot;
 		if (nvals == 0)
 			/* No one stat slot filled */
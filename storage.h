@@ -2,6 +2,7 @@
 #define STORAGE_H
 
 #include "nodes/pg_list.h"
+#include "storage/spin.h"
 #include "utils/array.h"
 #include "utils/dsa.h" /* Public structs have links to DSA memory blocks */
 
@@ -10,6 +11,34 @@
 
 #define STAT_SAMPLE_SIZE	(20)
 
+/* Weight of a new value in the streaming mean and variance */
+#define STAT_EWMA_WEIGHT	(0.1)
+
+#define STAT_SKETCH_NBUCKETS	(64)
+
+/*
+ * Streaming aggregate of a series: exponentially weighted moving mean and
+ * variance. Updated in O(1) and remembers much more values than the ring
+ * buffers of a stat entry.
+ */
+typedef struct StatEWMA
+{
+	int64	n;		/* Number of added values */
+	double	mean;
+	double	var;
+} StatEWMA;
+
+/*
+ * Logarithmic histogram of execution times (like DDSketch) to estimate their
+ * quantiles. Bucket i counts times in [2^(i/2), 2^((i+1)/2)) microseconds, so
+ * the relative error of a quantile is less than 20%. If a counter reaches its
+ * limit, all the counters are halved: the sketch forgets old executions.
+ */
+typedef struct StatSketch
+{
+	uint16	counts[STAT_SKETCH_NBUCKETS];
+} StatSketch;
+
 /*
  * Storage struct for AQO statistics
  * It is mostly needed for auto tuning feature. With auto tuning mode aqo
@@ -17,6 +46,13 @@
  * strong cardinality estimation on a query execution (planner bug?) and so on.
  * It can motivate aqo to suppress machine learning for this query class.
  * Also, it can be used for an analytics.
+ *
+ * The last values are kept in the ring buffers of single precision: the
+ * streaming aggregates below are the main source of the statistics, the ring
+ * buffers are only needed for the convergence checks and for the analytics.
+ * cur_stat_slot values are stored, the oldest one is at first_stat_slot. Copies
+ * of the entry, returned by the storage, are always unrolled: first_stat_slot
+ * is zero.
  */
 typedef struct StatEntry
 {
@@ -26,16 +62,40 @@ typedef struct StatEntry
 	int64	execs_without_aqo;
 
 	int		cur_stat_slot;
-	double	exec_time[STAT_SAMPLE_SIZE];
-	double	plan_time[STAT_SAMPLE_SIZE];
-	double	est_error[STAT_SAMPLE_SIZE];
+	int		first_stat_slot;
+	float4	exec_time[STAT_SAMPLE_SIZE];
+	float4	plan_time[STAT_SAMPLE_SIZE];
+	float4	est_error[STAT_SAMPLE_SIZE];
 
 	int		cur_stat_slot_aqo;
-	double	exec_time_aqo[STAT_SAMPLE_SIZE];
-	double	plan_time_aqo[STAT_SAMPLE_SIZE];
-	double	est_error_aqo[STAT_SAMPLE_SIZE];
+	int		first_stat_slot_aqo;
+	float4	exec_time_aqo[STAT_SAMPLE_SIZE];
+	float4	plan_time_aqo[STAT_SAMPLE_SIZE];
+	float4	est_error_aqo[STAT_SAMPLE_SIZE];
+
+	/* Streaming aggregates of the same series */
+	StatEWMA	exec_time_avg;
+	StatEWMA	plan_time_avg;
+	StatEWMA	est_error_avg;
+	StatSketch	exec_time_sketch;
+
+	StatEWMA	exec_time_avg_aqo;
+	StatEWMA	plan_time_avg_aqo;
+	StatEWMA	est_error_avg_aqo;
+	StatSketch	exec_time_sketch_aqo;
 } StatEntry;
 
+/*
+ * Entry of the shared stat hash table. The mutex protects the stat entry
+ * against concurrent updates under the shared stat_lock. Only the stat
+ * entry itself is stored on disk.
+ */
+typedef struct StatHashEntry
+{
+	StatEntry	stat; /* Must be the first field */
+	slock_t		mutex;
+} StatHashEntry;
+
 /*
  * Auxiliary struct, used for passing arguments
  * to aqo_stat_store() function.
@@ -103,8 +163,40 @@ typedef struct QueriesEntry
 
 	int64	smart_timeout;
 	int64	count_increase_timeout;
+
+	/*
+	 * Planning overhead budget: smoothed share of AQO estimation hooks in the
+	 * planning time and the prediction degradation, caused by it.
+	 */
+	double	plan_overhead;
+	int		plan_degradation;
+	int		join_limit;
+
+	/*
+	 * Learning sampling: probability to learn on an execution of the query
+	 * class and smoothed cardinality error, used to detect its convergence.
+	 */
+	double	learn_rate;
+	double	learn_error;
+
+	/*
+	 * Number of consecutive planning overhead samples over the budget
+	 * (positive) or well below it (negative).
+	 */
+	int		plan_overhead_streak;
 } QueriesEntry;
 
+/*
+ * Entry of the shared queries hash table. The mutex protects the planning
+ * overhead and learning sampling fields against concurrent updates under the
+ * shared queries_lock. Only the queries entry itself is stored on disk.
+ */
+typedef struct QueriesHashEntry
+{
+	QueriesEntry	entry; /* Must be the first field */
+	slock_t			mutex;
+} QueriesHashEntry;
+
 /*
  * Auxiliary struct, used for passing arg NULL signs
  * to aqo_queries_store() function.
@@ -135,6 +227,8 @@ extern HTAB *data_htab; /* TODO */
 
 extern StatEntry *aqo_stat_store(uint64 queryid, bool use_aqo,
 								 AqoStatArgs *stat_arg, bool append_mode);
+extern bool aqo_stat_count_execution(uint64 queryid, bool use_aqo);
+extern double stat_sketch_quantile(StatSketch *sketch, double q);
 extern void aqo_stat_flush(void);
 extern void aqo_stat_load(void);
 
@@ -0,0 +1,235 @@
+# Benchmark of the AQO planning overhead.
+#
+# Generates star and chain schemas and measures planning time of queries with
+# a growing number of joins in different AQO modes. It is not a test of
+# correctness and takes a while, so it is skipped unless the AQO_BENCHMARK
+# environment variable is set. Parameters:
+# AQO_BENCH_JOINS - comma-separated list of join numbers (2..20),
+# AQO_BENCH_LOOPS - number of planning iterations of a query in each mode,
+# AQO_BENCH_LEARN - number of executions to fill the knowledge base.
+#
+# Results are printed as a table and stored as CSV into the
+# aqo_planning_bench.csv file in the log directory of the test.
+
+use strict;
+use warnings;
+
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+if (!defined $ENV{AQO_BENCHMARK})
+{
+	plan skip_all => 'set AQO_BENCHMARK to run the planning overhead benchmark';
+}
+
+# Benchmark constants. Default values.
+my $MAX_JOINS = 20;
+my @JOINS = (2, 4, 8, 12, 16, 20);
+my $LOOPS = 20;
+my $LEARN_ITERATIONS = 5;
+my @MODES = ('disabled', 'frozen', 'learn', 'intelligent');
+
+if (defined $ENV{AQO_BENCH_JOINS})
+{
+	@JOINS = grep { $_ >= 2 && $_ <= $MAX_JOINS }
+			 split(/\s*,\s*/, $ENV{AQO_BENCH_JOINS});
+}
+if (defined $ENV{AQO_BENCH_LOOPS})
+{
+	$LOOPS = $ENV{AQO_BENCH_LOOPS};
+}
+if (defined $ENV{AQO_BENCH_LEARN})
+{
+	$LEARN_ITERATIONS = $ENV{AQO_BENCH_LEARN};
+}
+
+my $node = PostgreSQL::Test::Cluster->new('aqobench');
+$node->init;
+$node->append_conf('postgresql.conf', qq{
+						shared_preload_libraries = 'aqo'
+						aqo.mode = 'disabled'
+						aqo.join_threshold = 0
+						compute_query_id = 'on'
+						log_statement = 'none'
+					});
+
+# Disable connection default settings, forced by PGOPTIONS in AQO Makefile
+$ENV{PGOPTIONS}="";
+
+$node->start();
+$node->safe_psql('postgres', "CREATE EXTENSION aqo");
+
+# ##############################################################################
+#
+# Schemas: star (one fact table and a dimension per join) and chain (each table
+# references the next one).
+#
+# ##############################################################################
+
+my $ddl = '';
+my @fact_columns = map { "(gs * $_) % 100 + 1 AS d$_" } (1 .. $MAX_JOINS);
+
+$ddl .= "CREATE TABLE star_fact AS SELECT gs AS id, " .
+		join(', ', @fact_columns) . " FROM generate_series(1, 10000) AS gs;\n";
+foreach my $i (1 .. $MAX_JOINS)
+{
+	$ddl .= "CREATE TABLE star_dim$i AS SELECT gs AS id, gs % 10 AS val " .
+			"FROM generate_series(1, 100) AS gs;\n";
+}
+foreach my $i (0 .. $MAX_JOINS)
+{
+	$ddl .= "CREATE TABLE chain$i AS SELECT gs AS id, " .
+			"(gs * 7) % 1000 + 1 AS next FROM generate_series(1, 1000) AS gs;\n";
+}
+$ddl .= "ANALYZE;\n";
+$node->safe_psql('postgres', $ddl);
+
+sub star_query
+{
+	my ($njoins) = @_;
+
+	return "SELECT count(*) FROM star_fact f " .
+		join(' ', map { "JOIN star_dim$_ d$_ ON f.d$_ = d$_.id" } (1 .. $njoins)) .
+		" WHERE " . join(' AND ', map { "d$_.val < 5" } (1 .. $njoins));
+}
+
+sub chain_query
+{
+	my ($njoins) = @_;
+
+	return "SELECT count(*) FROM chain0 c0 " .
+		join(' ', map { "JOIN chain$_ c$_ ON c" . ($_ - 1) . ".next = c$_.id" }
+				  (1 .. $njoins)) .
+		" WHERE c0.id < 500";
+}
+
+# ##############################################################################
+#
+# Measurement routines
+#
+# ##############################################################################
+
+sub median
+{
+	my @sorted = sort { $a <=> $b } @_;
+	my $n = scalar(@sorted);
+
+	return 0 if ($n == 0);
+	return ($n % 2) ? $sorted[$n / 2] :
+					  ($sorted[$n / 2 - 1] + $sorted[$n / 2]) / 2;
+}
+
+sub query_id
+{
+	my ($query) = @_;
+	my $res = $node->safe_psql('postgres', "EXPLAIN (VERBOSE, COSTS OFF) $query");
+
+	return ($res =~ /Query Identifier: (-?\d+)/) ? $1 : undef;
+}
+
+# Run EXPLAIN of the query $LOOPS times in one session. Returns planning times.
+# Time of the AQO hooks is tracked from scratch for each run.
+sub planning_loop
+{
+	my ($mode, $query) = @_;
+	my $script = "SET aqo.mode = '$mode';\n" .
+				 "SET aqo.track_overhead = 'on';\n" .
+				 # Account time of the AQO hooks, but never degrade predictions
+				 "SET aqo.planning_overhead_limit = 1.0;\n" .
+				 ("EXPLAIN (COSTS OFF, SUMMARY ON) $query;\n" x $LOOPS);
+
+	$node->safe_psql('postgres', "SELECT aqo_overhead_reset()");
+	my $res = $node->safe_psql('postgres', $script);
+
+	return ($res =~ /Planning Time: ([\d.]+) ms/g);
+}
+
+# Mean time of the AQO planning hooks per planning of the query class, in ms,
+# measured by the last planning loop.
+sub hooks_time
+{
+	my ($queryid) = @_;
+
+	return 0 if (!defined $queryid);
+
+	my $res = $node->safe_psql('postgres', "
+		SELECT coalesce(sum(total_time), 0) FROM aqo_overhead
+		WHERE queryid = $queryid AND hook NOT IN ('learn', 'executor_end')");
+	return $res / $LOOPS;
+}
+
+sub kb_size
+{
+	my $res = $node->safe_psql('postgres', "
+		SELECT count(*) || ',' ||
+			   coalesce(sum(pg_column_size(features) + pg_column_size(targets) +
+							pg_column_size(reliability) + pg_column_size(oids)), 0)
+		FROM aqo_data");
+
+	return split(/,/, $res);
+}
+
+# ##############################################################################
+#
+# Benchmark
+#
+# ##############################################################################
+
+my @results;
+
+foreach my $schema ('star', 'chain')
+{
+	foreach my $njoins (@JOINS)
+	{
+		my $query = ($schema eq 'star') ? star_query($njoins) :
+										  chain_query($njoins);
+		my $queryid = query_id($query);
+
+		# Fill the knowledge base for the frozen mode
+		$node->safe_psql('postgres', "SET aqo.mode = 'learn';\n" .
+									 ("$query;\n" x $LEARN_ITERATIONS));
+		my ($kb_fss, $kb_bytes) = kb_size();
+
+		foreach my $mode (@MODES)
+		{
+			my @times = planning_loop($mode, $query);
+			my $planning = median(@times);
+			my $hooks = hooks_time($queryid);
+
+			is(scalar(@times), $LOOPS, "$schema, $njoins joins, $mode mode");
+
+			push @results, {
+				schema => $schema, joins => $njoins, mode => $mode,
+				planning => $planning, hooks => $hooks,
+				kb_fss => $kb_fss, kb_bytes => $kb_bytes };
+		}
+	}
+}
+
+# ##############################################################################
+#
+# Report
+#
+# ##############################################################################
+
+my $csv = "schema,joins,mode,planning_ms,aqo_hooks_ms,kb_fss,kb_bytes\n";
+
+diag(sprintf("%-6s %5s %-12s %12s %13s %7s %9s",
+			 'schema', 'joins', 'mode', 'planning, ms', 'aqo hooks, ms',
+			 'kb fss', 'kb bytes'));
+foreach my $r (@results)
+{
+	diag(sprintf("%-6s %5d %-12s %12.3f %13.3f %7d %9d",
+				 $r->{schema}, $r->{joins}, $r->{mode}, $r->{planning},
+				 $r->{hooks}, $r->{kb_fss}, $r->{kb_bytes}));
+	$csv .= sprintf("%s,%d,%s,%.3f,%.3f,%d,%d\n",
+					$r->{schema}, $r->{joins}, $r->{mode}, $r->{planning},
+					$r->{hooks}, $r->{kb_fss}, $r->{kb_bytes});
+}
+
+append_to_file("$PostgreSQL::Test::Utils::log_path/aqo_planning_bench.csv",
+			   $csv);
+
+$node->stop();
+done_testing();
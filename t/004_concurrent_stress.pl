@@ -0,0 +1,268 @@
+# Stress test of the AQO shared storage.
+#
+# Many pgbench clients learn, predict and concurrently remove the knowledge
+# base by aqo_cleanup(), aqo_drop_class() and aqo_reset(). Afterwards checks
+# that the storage is consistent: no corruption has been reported, no feature
+# subspace has more than aqo_K rows. At the second stage, without removals,
+# checks that the statistics and the counters only grow while the clients work.
+# Throughput of each stage is reported and stored as CSV into the
+# aqo_stress.csv file in the log directory of the test. Parameters:
+# AQO_STRESS_CLIENTS - number of pgbench clients,
+# AQO_STRESS_THREADS - number of pgbench threads,
+# AQO_STRESS_DURATION - duration of each stage, in seconds,
+# AQO_STRESS_WORKERS - number of learning workers (aqo.learn_workers).
+
+use strict;
+use warnings;
+
+use File::Temp;
+use IPC::Run;
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+# Test constants. Default values.
+my $CLIENTS = 8;
+my $THREADS = 4;
+my $DURATION = 10;
+my $WORKERS = 0;
+
+# Maximum number of rows in a feature subspace, see aqo_K in machine_learning.h
+my $AQO_K = 30;
+
+if (defined $ENV{AQO_STRESS_CLIENTS})
+{
+	$CLIENTS = $ENV{AQO_STRESS_CLIENTS};
+}
+if (defined $ENV{AQO_STRESS_THREADS})
+{
+	$THREADS = $ENV{AQO_STRESS_THREADS};
+}
+if (defined $ENV{AQO_STRESS_DURATION})
+{
+	$DURATION = $ENV{AQO_STRESS_DURATION};
+}
+if (defined $ENV{AQO_STRESS_WORKERS})
+{
+	$WORKERS = $ENV{AQO_STRESS_WORKERS};
+}
+$THREADS = $CLIENTS if ($THREADS > $CLIENTS);
+
+my $node = PostgreSQL::Test::Cluster->new('aqostress');
+$node->init;
+$node->append_conf('postgresql.conf', qq{
+						shared_preload_libraries = 'aqo'
+						aqo.mode = 'learn'
+						aqo.join_threshold = 0
+						aqo.learn_workers = $WORKERS
+						compute_query_id = 'on'
+						log_statement = 'none'
+						max_connections = } . ($CLIENTS + 20) . qq{
+					});
+
+# Disable connection default settings, forced by PGOPTIONS in AQO Makefile
+$ENV{PGOPTIONS}="";
+
+$node->start();
+$node->safe_psql('postgres', "
+	CREATE EXTENSION aqo;
+	CREATE TABLE a AS SELECT gs AS id, gs % 100 AS x, gs % 7 AS y
+		FROM generate_series(1, 10000) AS gs;
+	CREATE TABLE b AS SELECT gs AS id, gs % 50 AS x, gs % 3 AS y
+		FROM generate_series(1, 5000) AS gs;
+	CREATE TABLE c AS SELECT gs AS id, gs % 10 AS x
+		FROM generate_series(1, 1000) AS gs;
+	ANALYZE a, b, c;
+");
+
+# ##############################################################################
+#
+# Scripts of the clients
+#
+# ##############################################################################
+
+my $queries = q{
+	\set v random(1, 100)
+	SELECT count(*) FROM a WHERE x < :v AND y = :v % 7;
+	SELECT count(*) FROM a JOIN b ON a.id = b.id WHERE a.x < :v AND b.y <> 1;
+	SELECT count(*) FROM a JOIN b ON a.id = b.id JOIN c ON b.x = c.id
+	WHERE a.x > :v / 2 AND c.x < :v % 10;
+	SELECT b.y, count(*) FROM b JOIN c ON b.x = c.x WHERE b.id < :v * 50
+	GROUP BY b.y;
+};
+
+my $learn = File::Temp->new();
+append_to_file($learn, "SET aqo.mode = 'learn';\n" . $queries);
+
+my $predict = File::Temp->new();
+append_to_file($predict, q{
+	SET aqo.mode = 'frozen';
+	SET aqo.wide_search = 'on';
+} . $queries);
+
+my $cleanup = File::Temp->new();
+append_to_file($cleanup, q{
+	SET aqo.mode = 'disabled';
+	SELECT * FROM aqo_cleanup();
+});
+
+# The class can be removed concurrently, it isn't an error for the test
+my $drop = File::Temp->new();
+append_to_file($drop, q{
+	SET aqo.mode = 'disabled';
+	DO $$
+	DECLARE
+		qid bigint;
+	BEGIN
+		SELECT queryid INTO qid FROM aqo_queries
+		WHERE queryid <> 0 AND fs = queryid ORDER BY random() LIMIT 1;
+		IF qid IS NOT NULL THEN
+			PERFORM aqo_drop_class(qid);
+		END IF;
+	EXCEPTION WHEN OTHERS THEN
+		IF SQLERRM NOT LIKE '%Nothing to remove for the class%' THEN
+			RAISE;
+		END IF;
+	END $$;
+});
+
+my $reset = File::Temp->new();
+append_to_file($reset, q{
+	SET aqo.mode = 'disabled';
+	SELECT aqo_reset();
+});
+
+# Start pgbench with the given weighted scripts in background
+sub pgbench_start
+{
+	my ($out, $err, @scripts) = @_;
+	my @cmd = ('pgbench', '-n', '-T', $DURATION, '-c', $CLIENTS,
+			   '-j', $THREADS);
+
+	push @cmd, ('-f', $_) foreach (@scripts);
+	push @cmd, $node->connstr('postgres');
+
+	return IPC::Run::start(\@cmd, '>', $out, '2>', $err);
+}
+
+sub tps
+{
+	my ($out) = @_;
+
+	return ($out =~ /tps = ([\d.]+)/) ? $1 : 0;
+}
+
+sub storage_is_consistent
+{
+	my ($stage) = @_;
+	my $log = slurp_file($node->logfile);
+
+	unlike($log,
+		   qr/PANIC|storage is corrupted|hash table corrupted|Inconsistent data/,
+		   "$stage: no corruption of the storage reported");
+	is($node->safe_psql('postgres', "
+		SET aqo.mode = 'disabled';
+		SELECT count(*) FROM aqo_data
+		WHERE array_length(targets, 1) > $AQO_K OR
+			  array_length(targets, 1) <> array_length(reliability, 1) OR
+			  (nfeatures > 0 AND array_length(features, 1) <> array_length(targets, 1))"),
+		0, "$stage: no more than aqo_K rows in a feature subspace");
+}
+
+my @results;
+
+# ##############################################################################
+#
+# Stage 1: learning and prediction with concurrent removals
+#
+# ##############################################################################
+
+my ($out, $err) = ('', '');
+my $h = pgbench_start(\$out, \$err, "$learn\@50", "$predict\@40",
+					  "$cleanup\@2", "$drop\@5", "$reset\@1");
+$h->finish;
+
+is($h->result(0), 0, 'stage 1: pgbench is finished without errors')
+	or diag($err);
+storage_is_consistent('stage 1');
+push @results, { stage => 'removals', tps => tps($out) };
+
+# ##############################################################################
+#
+# Stage 2: learning and prediction only, the statistics must not decrease
+#
+# ##############################################################################
+
+sub snapshot
+{
+	my %snap;
+	my $res = $node->safe_psql('postgres', "
+		SET aqo.mode = 'disabled';
+		SELECT 'class ' || queryid || ' ' ||
+			   (executions_with_aqo + executions_without_aqo)
+		FROM aqo_query_stat
+		UNION ALL
+		SELECT 'learned 0 ' || learned FROM aqo_learning_counters()
+		UNION ALL
+		SELECT 'predictions 0 ' || (exact + wide + few_neighbors + misses)
+		FROM aqo_prediction_counters()");
+
+	foreach my $line (split(/\n/, $res))
+	{
+		my ($kind, $id, $value) = split(/ /, $line);
+
+		$snap{"$kind $id"} = $value;
+	}
+	return \%snap;
+}
+
+($out, $err) = ('', '');
+my $prev = snapshot();
+my $decreased = 0;
+
+$h = pgbench_start(\$out, \$err, "$learn\@60", "$predict\@40");
+while ($h->pumpable)
+{
+	my $cur;
+
+	sleep(1);
+	$h->pump_nb;
+	$cur = snapshot();
+	foreach my $key (keys %$prev)
+	{
+		if (!defined $cur->{$key} || $cur->{$key} < $prev->{$key})
+		{
+			diag("$key: $prev->{$key} -> " . ($cur->{$key} // 'removed'));
+			$decreased++;
+		}
+	}
+	$prev = $cur;
+}
+$h->finish;
+
+is($h->result(0), 0, 'stage 2: pgbench is finished without errors')
+	or diag($err);
+is($decreased, 0, 'stage 2: statistics and counters never decrease');
+storage_is_consistent('stage 2');
+push @results, { stage => 'learn_predict', tps => tps($out) };
+
+# ##############################################################################
+#
+# Report
+#
+# ##############################################################################
+
+my $csv = "stage,clients,threads,workers,duration_s,tps\n";
+
+foreach my $r (@results)
+{
+	diag(sprintf("%-14s clients %3d, threads %3d, workers %2d: %10.1f tps",
+				 $r->{stage}, $CLIENTS, $THREADS, $WORKERS, $r->{tps}));
+	$csv .= sprintf("%s,%d,%d,%d,%d,%.1f\n", $r->{stage}, $CLIENTS, $THREADS,
+					$WORKERS, $DURATION, $r->{tps});
+}
+
+append_to_file("$PostgreSQL::Test::Utils::log_path/aqo_stress.csv", $csv);
+
+$node->stop();
+done_testing();
@@ -0,0 +1,267 @@
+# Memory footprint of AQO.
+#
+# Learns and plans queries with a growing number of joins and a partitionwise
+# join of tables with many partitions, and records peak sizes of the AQO memory
+# contexts of the backend (see aqo_memory_peaks()) and the DSA memory of the
+# knowledge base per feature subspace. It takes a while, so it is skipped unless
+# the AQO_BENCHMARK environment variable is set. Parameters:
+# AQO_MEM_JOINS - comma-separated list of join numbers (2..50),
+# AQO_MEM_PARTITIONS - number of partitions of the partitioned tables,
+# AQO_MEM_LEARN - number of executions of each query,
+# AQO_MEM_BASELINE - CSV file of a previous run to compare with,
+# AQO_MEM_THRESHOLD - allowed growth of a value over the baseline (0.2 = 20%),
+# AQO_MEM_CTX_LIMIT - upper bound of a peak size of each AQO memory context, in
+#   bytes (64MB by default),
+# AQO_MEM_DSA_LIMIT - upper bound of the DSA memory per feature subspace, in
+#   bytes (64kB by default).
+#
+# The bounds are checked even without a baseline: a leak into a context, which
+# lives for a whole query or longer, or an unbounded growth of a knowledge base
+# entry exceeds them at the default parameters.
+#
+# Results are printed as a table and stored as CSV into the aqo_memory.csv file
+# in the log directory of the test. This file can be used as a baseline later.
+
+use strict;
+use warnings;
+
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+if (!defined $ENV{AQO_BENCHMARK})
+{
+	plan skip_all => 'set AQO_BENCHMARK to run the memory footprint benchmark';
+}
+
+# Benchmark constants. Default values.
+my $MAX_JOINS = 50;
+my @JOINS = (2, 10, 25, 50);
+my $PARTITIONS = 1000;
+my $LEARN_ITERATIONS = 3;
+my $THRESHOLD = 0.2;
+my $CTX_LIMIT = 64 * 1024 * 1024;
+my $DSA_LIMIT = 64 * 1024;
+my @METRICS = ('predict_peak', 'learn_peak', 'cache_peak', 'dsa_per_fss');
+
+if (defined $ENV{AQO_MEM_JOINS})
+{
+	@JOINS = grep { $_ >= 2 && $_ <= $MAX_JOINS }
+			 split(/\s*,\s*/, $ENV{AQO_MEM_JOINS});
+}
+if (defined $ENV{AQO_MEM_PARTITIONS})
+{
+	$PARTITIONS = $ENV{AQO_MEM_PARTITIONS};
+}
+if (defined $ENV{AQO_MEM_LEARN})
+{
+	$LEARN_ITERATIONS = $ENV{AQO_MEM_LEARN};
+}
+if (defined $ENV{AQO_MEM_THRESHOLD})
+{
+	$THRESHOLD = $ENV{AQO_MEM_THRESHOLD};
+}
+if (defined $ENV{AQO_MEM_CTX_LIMIT})
+{
+	$CTX_LIMIT = $ENV{AQO_MEM_CTX_LIMIT};
+}
+if (defined $ENV{AQO_MEM_DSA_LIMIT})
+{
+	$DSA_LIMIT = $ENV{AQO_MEM_DSA_LIMIT};
+}
+
+# Absolute upper bound of each metric
+my %LIMITS = (predict_peak => $CTX_LIMIT, learn_peak => $CTX_LIMIT,
+			  cache_peak => $CTX_LIMIT, dsa_per_fss => $DSA_LIMIT);
+
+my $node = PostgreSQL::Test::Cluster->new('aqomemory');
+$node->init;
+$node->append_conf('postgresql.conf', qq{
+						shared_preload_libraries = 'aqo'
+						aqo.mode = 'disabled'
+						aqo.join_threshold = 0
+						compute_query_id = 'on'
+						log_statement = 'none'
+						max_locks_per_transaction = 1024
+					});
+
+# Disable connection default settings, forced by PGOPTIONS in AQO Makefile
+$ENV{PGOPTIONS}="";
+
+$node->start();
+$node->safe_psql('postgres', "CREATE EXTENSION aqo");
+
+# ##############################################################################
+#
+# Schemas: a chain of tables, each references the next one, and two tables,
+# partitioned the same way.
+#
+# ##############################################################################
+
+my $ddl = '';
+
+foreach my $i (0 .. $MAX_JOINS)
+{
+	$ddl .= "CREATE TABLE chain$i AS SELECT gs AS id, " .
+			"(gs * 7) % 100 + 1 AS next FROM generate_series(1, 100) AS gs;\n";
+}
+foreach my $t ('pa', 'pb')
+{
+	$ddl .= "CREATE TABLE $t (id int, x int) PARTITION BY RANGE (id);\n";
+	foreach my $i (0 .. $PARTITIONS - 1)
+	{
+		$ddl .= "CREATE TABLE ${t}_$i PARTITION OF $t " .
+				"FOR VALUES FROM (" . ($i * 10) . ") TO (" . ($i * 10 + 10) . ");\n";
+	}
+	$ddl .= "INSERT INTO $t SELECT gs, gs % 10 " .
+			"FROM generate_series(0, " . ($PARTITIONS * 10 - 1) . ") AS gs;\n";
+}
+$ddl .= "ANALYZE;\n";
+$node->safe_psql('postgres', $ddl);
+
+sub chain_query
+{
+	my ($njoins) = @_;
+
+	return "SELECT count(*) FROM chain0 c0 " .
+		join(' ', map { "JOIN chain$_ c$_ ON c" . ($_ - 1) . ".next = c$_.id" }
+				  (1 .. $njoins)) .
+		" WHERE c0.id < 50";
+}
+
+sub partitions_query
+{
+	return "SELECT count(*) FROM pa JOIN pb ON pa.id = pb.id " .
+		   "WHERE pa.x < 5 AND pb.x > 2";
+}
+
+# ##############################################################################
+#
+# Measurement
+#
+# ##############################################################################
+
+# Learn on the query in one session and return the peaks of the contexts and
+# DSA bytes per feature subspace of the knowledge base.
+sub measure
+{
+	my ($query) = @_;
+	my %values;
+	my $res = $node->safe_psql('postgres', "
+		SELECT true FROM aqo_reset();
+		SET aqo.track_overhead = 'on';
+		SET enable_partitionwise_join = 'on';
+		SELECT aqo_memory_peaks_reset();
+		SET aqo.mode = 'learn';
+		" . ("$query;\n" x $LEARN_ITERATIONS) . "
+		SET aqo.mode = 'disabled';
+		SELECT 'predict_peak ' || peak_size FROM aqo_memory_peaks()
+		WHERE name = 'AQOPredictMemoryContext';
+		SELECT 'learn_peak ' || peak_size FROM aqo_memory_peaks()
+		WHERE name = 'AQOLearnMemoryContext';
+		SELECT 'cache_peak ' || peak_size FROM aqo_memory_peaks()
+		WHERE name = 'AQOCacheMemCtx';
+		SELECT 'dsa_per_fss ' || coalesce(used_bytes / nullif(
+			(SELECT count(*) FROM aqo_data), 0), 0)
+		FROM aqo_dsa_stat() WHERE area = 'data';
+		SELECT 'dsa_mismatch ' || (used_bytes - (
+			SELECT coalesce(sum(16 + 16 * array_length(targets, 1) +
+							8 * array_length(targets, 1) * nfeatures +
+							4 * coalesce(array_length(oids, 1), 0)), 0)
+			FROM aqo_data))
+		FROM aqo_dsa_stat() WHERE area = 'data';");
+
+	foreach my $line (split(/\n/, $res))
+	{
+		$values{$1} = $2 if ($line =~ /^(\w+) (-?\d+)$/);
+	}
+	return \%values;
+}
+
+my @results;
+
+foreach my $njoins (@JOINS)
+{
+	push @results, { case => 'chain', param => $njoins,
+					 values => measure(chain_query($njoins)) };
+}
+push @results, { case => 'partitions', param => $PARTITIONS,
+				 values => measure(partitions_query()) };
+
+foreach my $r (@results)
+{
+	my $name = "$r->{case} $r->{param}";
+
+	cmp_ok($r->{values}->{predict_peak} // 0, '>', 0,
+		   "$name: peak of the prediction context is tracked");
+	cmp_ok($r->{values}->{learn_peak} // 0, '>', 0,
+		   "$name: peak of the learning context is tracked");
+	is($r->{values}->{dsa_mismatch}, 0,
+	   "$name: DSA memory in use matches the knowledge base");
+
+	foreach my $metric (@METRICS)
+	{
+		cmp_ok($r->{values}->{$metric} // 0, '<=', $LIMITS{$metric},
+			   "$name: $metric doesn't exceed $LIMITS{$metric} bytes");
+	}
+}
+
+# ##############################################################################
+#
+# Comparison with the baseline
+#
+# ##############################################################################
+
+if (defined $ENV{AQO_MEM_BASELINE})
+{
+	my %baseline;
+
+	foreach my $line (split(/\n/, slurp_file($ENV{AQO_MEM_BASELINE})))
+	{
+		my ($case, $param, $metric, $value) = split(/,/, $line);
+
+		next if (!defined $value || $value !~ /^\d+$/);
+		$baseline{"$case,$param,$metric"} = $value;
+	}
+
+	foreach my $r (@results)
+	{
+		foreach my $metric (@METRICS)
+		{
+			my $key = "$r->{case},$r->{param},$metric";
+
+			next if (!defined $baseline{$key});
+			cmp_ok($r->{values}->{$metric}, '<=',
+				   $baseline{$key} * (1 + $THRESHOLD),
+				   "$r->{case} $r->{param}: $metric doesn't exceed the baseline");
+		}
+	}
+}
+
+# ##############################################################################
+#
+# Report
+#
+# ##############################################################################
+
+my $csv = "case,param,metric,value\n";
+
+diag(sprintf("%-10s %6s %14s %14s %14s %12s",
+			 'case', 'param', 'predict peak', 'learn peak', 'cache peak',
+			 'dsa per fss'));
+foreach my $r (@results)
+{
+	diag(sprintf("%-10s %6d %14d %14d %14d %12d",
+				 $r->{case}, $r->{param},
+				 map { $r->{values}->{$_} // 0 } @METRICS));
+	foreach my $metric (@METRICS)
+	{
+		$csv .= sprintf("%s,%d,%s,%d\n", $r->{case}, $r->{param}, $metric,
+						$r->{values}->{$metric} // 0);
+	}
+}
+
+append_to_file("$PostgreSQL::Test::Utils::log_path/aqo_memory.csv", $csv);
+
+$node->stop();
+done_testing();
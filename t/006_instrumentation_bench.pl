@@ -0,0 +1,169 @@
+# Benchmark of the row-count instrumentation of AQO.
+#
+# Runs a high-rate pgbench workload without AQO and in the learn mode with the
+# INSTRUMENT_ROWS instrumentation and with aqo.lightweight_instrumentation, and
+# compares throughput. It is not a test of correctness and takes a while, so it
+# is skipped unless the AQO_BENCHMARK environment variable is set. Parameters:
+# AQO_INSTR_CLIENTS - number of pgbench clients,
+# AQO_INSTR_THREADS - number of pgbench threads,
+# AQO_INSTR_DURATION - duration of each run, in seconds,
+# AQO_INSTR_SCALE - pgbench scale factor.
+#
+# Results are printed as a table and stored as CSV into the
+# aqo_instrumentation_bench.csv file in the log directory of the test.
+
+use strict;
+use warnings;
+
+use File::Temp;
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+if (!defined $ENV{AQO_BENCHMARK})
+{
+	plan skip_all => 'set AQO_BENCHMARK to run the instrumentation benchmark';
+}
+
+# Benchmark constants. Default values.
+my $CLIENTS = 8;
+my $THREADS = 4;
+my $DURATION = 20;
+my $SCALE = 10;
+
+if (defined $ENV{AQO_INSTR_CLIENTS})
+{
+	$CLIENTS = $ENV{AQO_INSTR_CLIENTS};
+}
+if (defined $ENV{AQO_INSTR_THREADS})
+{
+	$THREADS = $ENV{AQO_INSTR_THREADS};
+}
+if (defined $ENV{AQO_INSTR_DURATION})
+{
+	$DURATION = $ENV{AQO_INSTR_DURATION};
+}
+if (defined $ENV{AQO_INSTR_SCALE})
+{
+	$SCALE = $ENV{AQO_INSTR_SCALE};
+}
+$THREADS = $CLIENTS if ($THREADS > $CLIENTS);
+
+my $node = PostgreSQL::Test::Cluster->new('aqoinstr');
+$node->init;
+$node->append_conf('postgresql.conf', qq{
+						shared_preload_libraries = 'aqo'
+						aqo.mode = 'disabled'
+						aqo.join_threshold = 0
+						compute_query_id = 'on'
+						log_statement = 'none'
+						max_parallel_workers_per_gather = 0
+					});
+
+# Disable connection default settings, forced by PGOPTIONS in AQO Makefile
+$ENV{PGOPTIONS}="";
+
+$node->start();
+$node->command_ok([ 'pgbench', '-i', '-s', $SCALE ], 'init pgbench tables');
+$node->safe_psql('postgres', "CREATE EXTENSION aqo");
+
+# ##############################################################################
+#
+# Workloads: the select-only script of pgbench (one node per query) and a short
+# range join with an aggregate (several nodes with many tuples per query).
+#
+# ##############################################################################
+
+my $range_join = File::Temp->new();
+append_to_file($range_join, q{
+	\set aid random(1, 100000 * :scale - 100)
+	SELECT count(*) FROM pgbench_accounts a JOIN pgbench_branches b
+		ON a.bid = b.bid
+	WHERE a.aid BETWEEN :aid AND :aid + 100 AND b.bbalance >= 0;
+});
+
+my @WORKLOADS = (
+	{ name => 'select_only', args => [ '-S' ] },
+	{ name => 'range_join', args => [ '-f', "$range_join" ] });
+
+# Name, AQO mode and value of aqo.lightweight_instrumentation
+my @MODES = (
+	[ 'no_aqo', 'disabled', 'off' ],
+	[ 'instrument_rows', 'learn', 'off' ],
+	[ 'lightweight', 'learn', 'on' ]);
+
+sub tps
+{
+	my ($out) = @_;
+
+	return ($out =~ /tps = ([\d.]+)/) ? $1 : 0;
+}
+
+# ##############################################################################
+#
+# Benchmark
+#
+# ##############################################################################
+
+my @results;
+
+foreach my $w (@WORKLOADS)
+{
+	foreach my $m (@MODES)
+	{
+		my ($name, $mode, $lightweight) = @$m;
+
+		# Settings of new connections, the same for each transaction
+		$node->safe_psql('postgres', "
+			SELECT true FROM aqo_reset();
+			ALTER DATABASE postgres SET aqo.mode = '$mode';
+			ALTER DATABASE postgres SET aqo.lightweight_instrumentation = '$lightweight';");
+
+		my ($out, $err) = run_command([
+			'pgbench', '-n', '-T', $DURATION, '-c', $CLIENTS, '-j', $THREADS,
+			@{ $w->{args} }, $node->connstr('postgres') ]);
+
+		like($out, qr/tps = /, "$w->{name}, $name: pgbench is finished")
+			or diag($err);
+
+		push @results, { workload => $w->{name}, mode => $name,
+						 tps => tps($out) };
+	}
+}
+
+$node->safe_psql('postgres', "
+	ALTER DATABASE postgres RESET aqo.mode;
+	ALTER DATABASE postgres RESET aqo.lightweight_instrumentation;");
+
+# ##############################################################################
+#
+# Report
+#
+# ##############################################################################
+
+my $csv = "workload,mode,clients,threads,duration_s,tps,tps_vs_no_aqo\n";
+my %base;
+
+foreach my $r (@results)
+{
+	$base{$r->{workload}} = $r->{tps} if ($r->{mode} eq 'no_aqo');
+}
+
+diag(sprintf("%-12s %-16s %12s %14s", 'workload', 'mode', 'tps',
+			 'vs no aqo, %'));
+foreach my $r (@results)
+{
+	my $rel = $base{$r->{workload}} ?
+			  100. * $r->{tps} / $base{$r->{workload}} : 0;
+
+	diag(sprintf("%-12s %-16s %12.1f %14.1f", $r->{workload}, $r->{mode},
+				 $r->{tps}, $rel));
+	$csv .= sprintf("%s,%s,%d,%d,%d,%.1f,%.1f\n", $r->{workload}, $r->{mode},
+					$CLIENTS, $THREADS, $DURATION, $r->{tps}, $rel);
+}
+
+append_to_file(
+	"$PostgreSQL::Test::Utils::log_path/aqo_instrumentation_bench.csv", $csv);
+
+$node->stop();
+done_testing();